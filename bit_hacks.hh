@@ -2,6 +2,22 @@
 #define __BIT_HACKS_HH__
 
 #include <climits>
+#include <cstddef>
+#include <stdint.h>
+#include <algorithm>
+
+#ifndef __has_builtin
+	#define __has_builtin(x) 0
+#endif
+
+//bits of the index split off at both ends by bitreversal_cobra()
+#ifndef BITREV_COBRA_BITS
+	#define BITREV_COBRA_BITS 4
+#endif
+//sizes from here on are permuted by bitreversal_cobra()
+#ifndef BITREV_COBRA_MIN_SIZE
+	#define BITREV_COBRA_MIN_SIZE (1 << 10)
+#endif
 
 template <class T>
 T next_power_of_two(T x) {
@@ -15,31 +31,60 @@ T next_power_of_two(T x) {
 	return x + 1;
 };
 
-unsigned char bit_reverse_byte(unsigned char x) {
+inline unsigned char bit_reverse_byte(unsigned char x) {
 	x = ((x & 0xf) << 4) | ((x & 0xf0) >> 4);
 	x = ((x & 0x33) << 2) | ((x & 0xcc) >> 2);
 	x = ((x & 0x55) << 1) | ((x & 0xaa) >> 1);
 	return x;
 }
 
+/*
+ * Reverses the bits inside every byte of x at once, the byte order is
+ * then flipped by a byte swap.
+ */
+inline uint64_t bit_reverse_bytes(uint64_t x) {
+	x = ((x & 0x0f0f0f0f0f0f0f0full) << 4) | ((x >> 4) & 0x0f0f0f0f0f0f0f0full);
+	x = ((x & 0x3333333333333333ull) << 2) | ((x >> 2) & 0x3333333333333333ull);
+	x = ((x & 0x5555555555555555ull) << 1) | ((x >> 1) & 0x5555555555555555ull);
+	return x;
+}
+
+inline uint64_t bit_reverse_64(uint64_t x) {
+#if __has_builtin(__builtin_bitreverse64)
+	return __builtin_bitreverse64(x);
+#elif defined(__aarch64__) && defined(__GNUC__)
+	__asm__("rbit %0, %1" : "=r"(x) : "r"(x));
+	return x;
+#elif defined(__GNUC__)
+	return __builtin_bswap64(bit_reverse_bytes(x));
+#else
+	uint64_t ret = 0;
+	for (size_t i = 0; i < 64; i += CHAR_BIT) {
+		ret |= (uint64_t)bit_reverse_byte((x >> i) & 0xff) << (56 - i);
+	}
+	return ret;
+#endif
+}
+
 template<class T>
 T bit_reverse(T x) {
-	T ret = 0;
-	size_t nbits = (sizeof(T) - 1) * CHAR_BIT;
-	for (size_t i = 0; i <= nbits; i += CHAR_BIT) {
-		T new_byte = bit_reverse_byte((x >> i) & 0xff);
-		ret |= new_byte << (nbits - i);
-	}
+	//the reversed word ends up in the top bits of the 64-bit one
+	return static_cast<T>(bit_reverse_64(static_cast<uint64_t>(x)) >>
+		(64 - sizeof(T) * CHAR_BIT));
+}
 
-	return ret;
+//x with its low bits bits reversed, the rest must be zero
+inline size_t reverse_bits(size_t x, unsigned bits) {
+	return bits ? static_cast<size_t>(bit_reverse_64(x) >> (64 - bits)) : 0;
 }
 
+//Gold-Rader increment, no table and no buffer
 template<class T>
 void bitreversal_permutation(T *vec, size_t size) {
 	size_t j = 0;
 	for (size_t i = 0; i < size - 1; i++) {
 		if (i < j) {
-			swap(vec[i], vec[j]);
+			std::swap(vec[i], vec[j]);
 		}
 		size_t k = size >> 1;
 		while (k <= j) {
@@ -50,4 +95,98 @@ void bitreversal_permutation(T *vec, size_t size) {
 	}
 }
 
+//table[i] is the bit reversal of i
+template<class T>
+void bitreversal_table(T *vec, size_t size, const size_t *table) {
+	for (size_t i = 0; i < size; i++) {
+		size_t j = table[i];
+		if (i < j) {
+			std::swap(vec[i], vec[j]);
+		}
+	}
+}
+
+/*
+ * Cache-oblivious bit reversal (COBRA, Carter and Gatlin). An index is
+ * split into a | c | d where a and d have BITREV_COBRA_BITS bits each.
+ * All elements with the middle bits c form a tile of short contiguous
+ * rows. The tile is copied to a buffer that stays in cache together
+ * with the tile of rev(c), and both are written back to the other's
+ * place with a and d reversed and swapped, so main memory is touched
+ * a row at a time instead of an element at a time.
+ * Sizes below 2^(2 * BITREV_COBRA_BITS) use the Gold-Rader loop.
+ */
+template<class T>
+void bitreversal_cobra(T *vec, size_t size) {
+	const unsigned b = BITREV_COBRA_BITS;
+	const size_t side = size_t(1) << b;
+
+	unsigned lg = 0;
+	while ((size_t(1) << lg) < size) {
+		lg++;
+	}
+	if (lg < 2 * b) {
+		bitreversal_permutation(vec, size);
+		return;
+	}
+
+	const unsigned m = lg - 2 * b;
+	const size_t middle = size_t(1) << m;
+	size_t rev[side];
+	for (size_t i = 0; i < side; i++) {
+		rev[i] = reverse_bits(i, b);
+	}
+
+	T tile[side * side];
+	T other[side * side];
+	for (size_t c = 0; c < middle; c++) {
+		size_t rc = reverse_bits(c, m);
+		if (c > rc) {
+			continue;
+		}
+
+		//tile[a][d] = vec[a | c | d], a row per a
+		for (size_t a = 0; a < side; a++) {
+			const T *src = vec + (a << (m + b)) + (c << b);
+			std::copy(src, src + side, tile + side * a);
+		}
+		if (c != rc) {
+			for (size_t a = 0; a < side; a++) {
+				const T *src = vec + (a << (m + b)) + (rc << b);
+				std::copy(src, src + side, other + side * a);
+			}
+		}
+
+		//a | c | d goes to rev(d) | rev(c) | rev(a)
+		for (size_t d = 0; d < side; d++) {
+			T *dst = vec + (rev[d] << (m + b)) + (rc << b);
+			for (size_t a = 0; a < side; a++) {
+				dst[rev[a]] = tile[side * a + d];
+			}
+		}
+		if (c != rc) {
+			for (size_t d = 0; d < side; d++) {
+				T *dst = vec + (rev[d] << (m + b)) + (c << b);
+				for (size_t a = 0; a < side; a++) {
+					dst[rev[a]] = other[side * a + d];
+				}
+			}
+		}
+	}
+}
+
+//picks by size, table may be NULL
+template<class T>
+void bitreversal_auto(T *vec, size_t size, const size_t *table) {
+	if (size >= BITREV_COBRA_MIN_SIZE) {
+		bitreversal_cobra(vec, size);
+	}
+	else if (table) {
+		bitreversal_table(vec, size, table);
+	}
+	else {
+		bitreversal_permutation(vec, size);
+	}
+}
+
 #endif
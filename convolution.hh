@@ -2,18 +2,40 @@
 #define __CONVOLUTION_HH__
 
 #include <vector>
+#include <complex>
+#include <algorithm>
 
+#include "fft.hh"
+
+/*
+ * Cost of an FFT convolution relative to the direct one, per
+ * N * log2(N) of the padded transform size N against one multiply-add
+ * of the direct sum. Measured with tests/conv_1d.
+ */
+#ifndef CONV_FFT_COST
+	#define CONV_FFT_COST 10.0
+#endif
+//kernels this short are always convolved directly
+#ifndef CONV_DIRECT_MAX_TAPS
+	#define CONV_DIRECT_MAX_TAPS 32
+#endif
+
+enum ConvolutionMethod {
+	CONV_AUTO,
+	CONV_DIRECT,
+	CONV_FFT,
+};
+
+//ret[i] += sum of f[i - j] * g[j], i < f.size()
 template <class T>
 static void convolve1D(std::vector<T> &f, std::vector <T> &g,
 	std::vector<T> &ret) {
 	size_t nf = f.size();
 	size_t ng = g.size();
 	for (size_t i = 0; i < nf; i++) {
-		for (size_t j = 0; j < ng; j++) {
-			size_t idx_sig = i - j;
-			if (idx_sig >= 0 && idx_sig < nf) {
-				ret[i] += f[idx_sig] * g[j];
-			}
+		size_t jmax = std::min(ng, i + 1);
+		for (size_t j = 0; j < jmax; j++) {
+			ret[i] += f[i - j] * g[j];
 		}
 	}
 }
@@ -34,4 +56,560 @@ static void convolveCircular1D(std::vector<T> &f, std::vector <T> &g,
 	}
 }
 
+//even transform size the FFT convolution pads nf + ng - 1 samples to
+static inline size_t convolution_fft_size(size_t nf, size_t ng) {
+	size_t n = nf + ng - 1;
+	return 2 * fft_fast_size((n + 1) / 2);
+}
+
+//the cheaper way to convolve nf samples with ng taps
+static inline ConvolutionMethod convolution_method(size_t nf, size_t ng) {
+	if (std::min(nf, ng) <= CONV_DIRECT_MAX_TAPS) {
+		return CONV_DIRECT;
+	}
+	double n = convolution_fft_size(nf, ng);
+	double fft_cost = CONV_FFT_COST * n * log2(n);
+	return fft_cost < (double)nf * ng ? CONV_FFT : CONV_DIRECT;
+}
+
+/*
+ * Full linear convolution, out holds nf + ng - 1 samples.
+ * The loop runs along the kernel so that it has no bounds checks
+ * and vectorizes.
+ */
+template <class T>
+static void convolve_direct(const T *f, size_t nf, const T *g, size_t ng,
+	T *out)
+{
+	std::fill(out, out + nf + ng - 1, T(0));
+	for (size_t i = 0; i < nf; i++) {
+		T x = f[i];
+		T *dst = out + i;
+		for (size_t j = 0; j < ng; j++) {
+			dst[j] += x * g[j];
+		}
+	}
+}
+
+/*
+ * Full linear convolution of real samples through real FFTs of a
+ * zero padded size with no prime factors above 5. The 1 / N of the
+ * inverse is folded into the spectrum product.
+ */
+template <class T>
+static void convolve_fft(const T *f, size_t nf, const T *g, size_t ng,
+	T *out)
+{
+	size_t n = convolution_fft_size(nf, ng);
+	size_t bins = n / 2 + 1;
+	RealFftPlan<T> &plan = rfft_cached_plan<T>(n, FFT_UNNORMALIZED);
+
+	std::vector<T> buf(n, T(0));
+	std::vector<std::complex<T> > fs(bins), gs(bins);
+
+	std::copy(f, f + nf, buf.begin());
+	plan.forward(buf.data(), fs.data());
+	std::fill(buf.begin(), buf.end(), T(0));
+	std::copy(g, g + ng, buf.begin());
+	plan.forward(buf.data(), gs.data());
+
+	const T scale = T(1) / n;
+	for (size_t k = 0; k < bins; k++) {
+		fs[k] = complex_mul(fs[k], gs[k]) * scale;
+	}
+	plan.inverse(fs.data(), buf.data());
+	std::copy(buf.begin(), buf.begin() + nf + ng - 1, out);
+}
+
+/*
+ * Full linear convolution, out holds nf + ng - 1 samples. CONV_AUTO
+ * picks the direct sum or the FFT from the lengths. The FFT path
+ * takes float, double or long double samples.
+ */
+template <class T>
+static void convolve(const T *f, size_t nf, const T *g, size_t ng, T *out,
+	ConvolutionMethod method = CONV_AUTO)
+{
+	if (!nf || !ng) {
+		return;
+	}
+	if (method == CONV_AUTO) {
+		method = convolution_method(nf, ng);
+	}
+	if (method == CONV_FFT) {
+		convolve_fft(f, nf, g, ng, out);
+	}
+	else {
+		convolve_direct(f, nf, g, ng, out);
+	}
+}
+
+template <class T>
+static void convolve(const std::vector<T> &f, const std::vector<T> &g,
+	std::vector<T> &ret, ConvolutionMethod method = CONV_AUTO)
+{
+	ret.resize(f.empty() || g.empty() ? 0 : f.size() + g.size() - 1);
+	convolve(f.data(), f.size(), g.data(), g.size(), ret.data(), method);
+}
+
+enum BlockConvolutionMethod {
+	OVERLAP_SAVE,
+	OVERLAP_ADD,
+};
+
+/*
+ * Block transform size for a filter of taps samples: the one with the
+ * least work per output sample unless one is asked for, at least
+ * 2 * taps and even.
+ */
+static inline size_t block_fft_size(size_t taps, size_t size = 0)
+{
+	if (size) {
+		return 2 * fft_fast_size((std::max(size, 2 * taps) + 1) / 2);
+	}
+	size_t best = 0;
+	double best_cost = 0;
+	for (size_t n = next_power_of_two(2 * taps); n <= 64 * taps; n *= 2) {
+		double cost = n * log2(n) / (n - taps + 1);
+		if (!best || cost < best_cost) {
+			best = n;
+			best_cost = cost;
+		}
+	}
+	return best;
+}
+
+/*
+ * Streaming FFT convolution of an endless signal with a fixed filter.
+ * Samples are pushed in blocks of any length and the filtered ones
+ * pulled back; the output is the full linear convolution, delayed by
+ * nothing but the block size. Every N sample transform turns
+ * L = N - taps + 1 inputs into L outputs:
+ *
+ * overlap-save keeps the last taps - 1 inputs in front of the block
+ * and drops the first taps - 1 outputs, which are wrapped around.
+ * overlap-add transforms the L inputs zero padded to N and adds the
+ * taps - 1 samples running past the block to the next one.
+ *
+ * The filter spectrum is computed once with 1 / N folded in, and all
+ * buffers are allocated up front: the work per block is constant and
+ * memory only grows if output is pushed but never pulled.
+ */
+template <class T>
+class BlockConvolver {
+protected:
+	BlockConvolutionMethod mMethod;
+	size_t mTaps;
+	size_t mSize;
+	size_t mBlock;
+	RealFftPlan<T> mPlan;
+	std::vector<std::complex<T> > mFilter;
+	std::vector<std::complex<T> > mSpectrum;
+
+	//overlap-save: taps - 1 old inputs then the block being filled
+	//overlap-add: the block being filled
+	std::vector<T> mInput;
+	size_t mFill;
+	//overlap-add: the tail added to the next block
+	std::vector<T> mTail;
+	std::vector<T> mWork;
+
+	//filtered samples not pulled yet start at mOutputStart
+	std::vector<T> mOutput;
+	size_t mOutputStart;
+
+	void process_block() {
+		size_t overlap = mTaps - 1;
+		size_t bins = mSize / 2 + 1;
+
+		if (mMethod == OVERLAP_SAVE) {
+			mPlan.forward(mInput.data(), mSpectrum.data());
+		}
+		else {
+			std::copy(mInput.begin(), mInput.begin() + mBlock, mWork.begin());
+			std::fill(mWork.begin() + mBlock, mWork.end(), T(0));
+			mPlan.forward(mWork.data(), mSpectrum.data());
+		}
+		for (size_t k = 0; k < bins; k++) {
+			mSpectrum[k] = complex_mul(mSpectrum[k], mFilter[k]);
+		}
+		mPlan.inverse(mSpectrum.data(), mWork.data());
+
+		//drop what was pulled before growing the output
+		if (mOutputStart) {
+			mOutput.erase(mOutput.begin(), mOutput.begin() + mOutputStart);
+			mOutputStart = 0;
+		}
+
+		if (mMethod == OVERLAP_SAVE) {
+			mOutput.insert(mOutput.end(), mWork.begin() + overlap, mWork.end());
+			std::copy(mInput.end() - overlap, mInput.end(), mInput.begin());
+		}
+		else {
+			for (size_t i = 0; i < overlap; i++) {
+				mWork[i] += mTail[i];
+			}
+			mOutput.insert(mOutput.end(), mWork.begin(),
+				mWork.begin() + mBlock);
+			std::copy(mWork.begin() + mBlock, mWork.begin() + mBlock + overlap,
+				mTail.begin());
+		}
+		mFill = 0;
+	}
+
+	inline T *fill_start() {
+		return mInput.data() + (mMethod == OVERLAP_SAVE ? mTaps - 1 : 0);
+	}
+
+public:
+	/*
+	 * size is the transform size, 0 picks the one with the least work
+	 * per sample; it is rounded up to an even size of at least 2 * taps.
+	 */
+	BlockConvolver(const T *filter, size_t taps,
+		BlockConvolutionMethod method = OVERLAP_SAVE, size_t size = 0)
+		: mMethod(method), mTaps(std::max<size_t>(taps, 1)),
+		mSize(block_fft_size(mTaps, size)),
+		mBlock(mSize - mTaps + 1),
+		mPlan(mSize, FFT_UNNORMALIZED),
+		mFilter(mSize / 2 + 1), mSpectrum(mSize / 2 + 1),
+		mInput(method == OVERLAP_SAVE ? mSize : mBlock, T(0)), mFill(0),
+		mTail(mTaps - 1, T(0)), mWork(mSize),
+		mOutputStart(0)
+	{
+		std::fill(mWork.begin(), mWork.end(), T(0));
+		std::copy(filter, filter + taps, mWork.begin());
+		mPlan.forward(mWork.data(), mFilter.data());
+		const T scale = T(1) / mSize;
+		for (size_t k = 0; k < mFilter.size(); k++) {
+			mFilter[k] *= scale;
+		}
+		mOutput.reserve(2 * mBlock);
+	}
+
+	inline size_t taps() const {
+		return mTaps;
+	}
+
+	inline size_t fft_size() const {
+		return mSize;
+	}
+
+	//inputs per transform, output comes in steps of this many samples
+	inline size_t block_size() const {
+		return mBlock;
+	}
+
+	//filtered samples ready to be pulled
+	inline size_t available() const {
+		return mOutput.size() - mOutputStart;
+	}
+
+	void push(const T *in, size_t count) {
+		while (count) {
+			size_t n = std::min(count, mBlock - mFill);
+			std::copy(in, in + n, fill_start() + mFill);
+			mFill += n;
+			in += n;
+			count -= n;
+			if (mFill == mBlock) {
+				process_block();
+			}
+		}
+	}
+
+	//copies up to count filtered samples to out, returns how many
+	size_t pull(T *out, size_t count) {
+		count = std::min(count, available());
+		std::copy(mOutput.begin() + mOutputStart,
+			mOutput.begin() + mOutputStart + count, out);
+		mOutputStart += count;
+		return count;
+	}
+
+	/*
+	 * Ends the signal: pushes zeros until the last taps - 1 samples of
+	 * the convolution are out as well, then starts over.
+	 */
+	void flush() {
+		size_t pending = mFill + mTaps - 1;
+		//the last block holds fewer real samples, cut its output
+		size_t keep = available() + pending;
+		while (pending) {
+			size_t n = std::min(pending, mBlock - mFill);
+			std::fill(fill_start() + mFill, fill_start() + mFill + n, T(0));
+			mFill += n;
+			pending -= n;
+			if (mFill == mBlock) {
+				process_block();
+			}
+		}
+		if (mFill) {
+			std::fill(fill_start() + mFill, fill_start() + mBlock, T(0));
+			process_block();
+		}
+		mOutput.resize(mOutputStart + keep);
+		reset();
+	}
+
+	//forgets the signal, output not pulled yet stays
+	void reset() {
+		std::fill(mInput.begin(), mInput.end(), T(0));
+		std::fill(mTail.begin(), mTail.end(), T(0));
+		mFill = 0;
+	}
+};
+
+//partitions of one size before the non-uniform layout doubles it
+#ifndef PARTCONV_PARTITIONS_PER_SIZE
+	#define PARTCONV_PARTITIONS_PER_SIZE 4
+#endif
+//largest partition of the non-uniform layout by default
+#ifndef PARTCONV_MAX_PARTITION
+	#define PARTCONV_MAX_PARTITION 1024
+#endif
+
+/*
+ * Low latency convolution with long filters, uniformly or non-uniformly
+ * partitioned. The filter is cut into partitions whose spectra are
+ * kept, and the spectra of past input blocks sit in a frequency-domain
+ * delay line: a block of output is the inverse transform of the sum of
+ * delay line entry p times partition p. The latency is one block of
+ * block samples whatever the filter length.
+ *
+ * Uniform partitioning cuts the whole filter into block size
+ * partitions. Non-uniform partitioning only does so for the head, and
+ * then doubles the partition size every PARTCONV_PARTITIONS_PER_SIZE
+ * partitions up to max_partition, so a long tail costs a few large
+ * transforms instead of many small products. A segment of partition
+ * size S starting at filter offset o runs every S / block blocks and
+ * needs o >= S - block to be on time, which the doubling keeps.
+ *
+ * To keep the work per block steady the products of the older delay
+ * line entries are accumulated a slice per block between the
+ * transforms of a segment, only the newest entry is multiplied when
+ * the segment output is due.
+ */
+template <class T>
+class PartitionedConvolver {
+protected:
+	struct Segment {
+		size_t size;
+		size_t offset;
+		size_t count;
+		//blocks per transform
+		size_t period;
+		RealFftPlan<T> plan;
+		//partition spectra, size + 1 bins each, 1 / (2 * size) folded in
+		std::vector<std::complex<T> > filter;
+		//input spectra, entry head is the newest one
+		std::vector<std::complex<T> > delay_line;
+		size_t head;
+		std::vector<std::complex<T> > acc;
+		//the previous and the current input block
+		std::vector<T> input;
+		std::vector<T> work;
+		size_t fill;
+
+		Segment(const T *taps, size_t ntaps, size_t size, size_t offset,
+			size_t count, size_t block)
+			: size(size), offset(offset), count(count), period(size / block),
+			plan(2 * size, FFT_UNNORMALIZED),
+			filter(count * (size + 1)), delay_line(count * (size + 1)),
+			head(0), acc(size + 1), input(2 * size, T(0)),
+			work(2 * size), fill(0)
+		{
+			const T scale = T(1) / (2 * size);
+			for (size_t p = 0; p < count; p++) {
+				std::fill(work.begin(), work.end(), T(0));
+				size_t start = offset + p * size;
+				size_t end = std::min(start + size, ntaps);
+				if (start < end) {
+					std::copy(taps + start, taps + end, work.begin());
+				}
+				std::complex<T> *h = filter.data() + p * (size + 1);
+				plan.forward(work.data(), h);
+				for (size_t k = 0; k <= size; k++) {
+					h[k] *= scale;
+				}
+			}
+		}
+
+		//acc += delay line entry age - 1 times partition age
+		void accumulate(size_t first, size_t last) {
+			size_t bins = size + 1;
+			for (size_t age = first; age < last; age++) {
+				const std::complex<T> *x = delay_line.data() +
+					((head + age - 1) % count) * bins;
+				const std::complex<T> *h = filter.data() + age * bins;
+				for (size_t k = 0; k < bins; k++) {
+					acc[k] += complex_mul(x[k], h[k]);
+				}
+			}
+		}
+
+		void reset() {
+			std::fill(delay_line.begin(), delay_line.end(),
+				std::complex<T>(0));
+			std::fill(acc.begin(), acc.end(), std::complex<T>(0));
+			std::fill(input.begin(), input.end(), T(0));
+			head = 0;
+			fill = 0;
+		}
+	};
+
+	size_t mBlock;
+	size_t mTaps;
+	std::vector<std::unique_ptr<Segment> > mSegments;
+
+	//output accumulator indexed by absolute sample time modulo its size
+	std::vector<T> mOutput;
+	size_t mOutputMask;
+	size_t mTime;
+
+	//process(): the block being filled and the output block it replaces
+	std::vector<T> mBlockIn;
+	std::vector<T> mBlockOut;
+	size_t mFill;
+
+	void step(Segment &seg, const T *in) {
+		std::copy(in, in + mBlock, seg.input.begin() + seg.size + seg.fill);
+		seg.fill += mBlock;
+
+		//this block's slice of the older products
+		size_t older = seg.count - 1;
+		size_t slice = (older + seg.period - 1) / seg.period;
+		size_t j = seg.fill / mBlock - 1;
+		size_t first = 1 + std::min(older, j * slice);
+		size_t last = 1 + std::min(older, (j + 1) * slice);
+		seg.accumulate(first, last);
+
+		if (seg.fill < seg.size) {
+			return;
+		}
+
+		size_t bins = seg.size + 1;
+		seg.head = (seg.head + seg.count - 1) % seg.count;
+		std::complex<T> *x = seg.delay_line.data() + seg.head * bins;
+		seg.plan.forward(seg.input.data(), x);
+		for (size_t k = 0; k < bins; k++) {
+			seg.acc[k] += complex_mul(x[k], seg.filter[k]);
+		}
+		seg.plan.inverse(seg.acc.data(), seg.work.data());
+
+		//the last size samples are the output of the block that ends
+		//now, offset samples later
+		size_t start = mTime + mBlock - seg.size + seg.offset;
+		for (size_t i = 0; i < seg.size; i++) {
+			mOutput[(start + i) & mOutputMask] += seg.work[seg.size + i];
+		}
+
+		std::fill(seg.acc.begin(), seg.acc.end(), std::complex<T>(0));
+		std::copy(seg.input.begin() + seg.size, seg.input.end(),
+			seg.input.begin());
+		seg.fill = 0;
+	}
+
+public:
+	/*
+	 * block is the latency and the partition size of the head,
+	 * max_partition the largest partition size of a non-uniform layout.
+	 * Both are rounded up to powers of two, a max_partition not above
+	 * block partitions uniformly. Beyond 1024 or so the transforms of
+	 * the large partitions make some blocks much slower than the rest.
+	 */
+	PartitionedConvolver(const T *filter, size_t taps, size_t block = 64,
+		size_t max_partition = PARTCONV_MAX_PARTITION)
+		: mBlock(next_power_of_two(std::max<size_t>(block, 1))),
+		mTaps(std::max<size_t>(taps, 1)), mOutputMask(0), mTime(0),
+		mBlockIn(mBlock, T(0)), mBlockOut(mBlock, T(0)), mFill(0)
+	{
+		max_partition = std::max(mBlock, next_power_of_two(max_partition));
+		std::vector<T> padded(filter, filter + taps);
+		padded.resize(mTaps, T(0));
+
+		size_t offset = 0;
+		size_t size = mBlock;
+		size_t span = 0;
+		while (offset < mTaps) {
+			size_t left = (mTaps - offset + size - 1) / size;
+			bool last = size >= max_partition;
+			size_t count = last ? left :
+				std::min<size_t>(left, PARTCONV_PARTITIONS_PER_SIZE);
+			mSegments.push_back(std::unique_ptr<Segment>(new Segment(
+				padded.data(), mTaps, size, offset, count, mBlock)));
+			offset += count * size;
+			span = std::max(span, offset + mBlock);
+			if (!last) {
+				size *= 2;
+			}
+		}
+
+		mOutput.resize(next_power_of_two(span + mBlock), T(0));
+		mOutputMask = mOutput.size() - 1;
+	}
+
+	inline size_t block_size() const {
+		return mBlock;
+	}
+
+	inline size_t taps() const {
+		return mTaps;
+	}
+
+	//number of partitions of every size, smallest first
+	std::vector<std::pair<size_t, size_t> > layout() const {
+		std::vector<std::pair<size_t, size_t> > ret;
+		for (size_t i = 0; i < mSegments.size(); i++) {
+			ret.push_back(std::make_pair(mSegments[i]->size,
+				mSegments[i]->count));
+		}
+		return ret;
+	}
+
+	/*
+	 * Filters one block of block_size() samples, out is the convolution
+	 * for the same samples. Not to be mixed with process().
+	 */
+	void process_block(const T *in, T *out) {
+		for (size_t i = 0; i < mSegments.size(); i++) {
+			step(*mSegments[i], in);
+		}
+		for (size_t i = 0; i < mBlock; i++) {
+			T &y = mOutput[(mTime + i) & mOutputMask];
+			out[i] = y;
+			y = T(0);
+		}
+		mTime += mBlock;
+	}
+
+	//any number of samples, the output is late by block_size() samples
+	void process(const T *in, T *out, size_t count) {
+		while (count) {
+			size_t n = std::min(count, mBlock - mFill);
+			std::copy(in, in + n, mBlockIn.begin() + mFill);
+			std::copy(mBlockOut.begin() + mFill, mBlockOut.begin() + mFill + n,
+				out);
+			mFill += n;
+			in += n;
+			out += n;
+			count -= n;
+			if (mFill == mBlock) {
+				process_block(mBlockIn.data(), mBlockOut.data());
+				mFill = 0;
+			}
+		}
+	}
+
+	void reset() {
+		for (size_t i = 0; i < mSegments.size(); i++) {
+			mSegments[i]->reset();
+		}
+		std::fill(mOutput.begin(), mOutput.end(), T(0));
+		std::fill(mBlockOut.begin(), mBlockOut.end(), T(0));
+		mTime = 0;
+		mFill = 0;
+	}
+};
+
 #endif
@@ -2,33 +2,990 @@
 #define __CORRELATION_HH__
 
 #include <vector>
+#include <complex>
+#include <algorithm>
+#include <math.h>
 
+#include "convolution.hh"
+
+//ret[i] += sum of f[i + j] * g[j], i < f.size()
 template <class T>
 static void correlate1D(std::vector<T> &f, std::vector <T> &g,
 	std::vector<T> &ret) {
 	size_t nf = f.size();
 	size_t ng = g.size();
 	for (size_t i = 0; i < nf; i++) {
-		for (size_t j = 0; j < ng; j++) {
-			size_t idx_sig = i + j;
-			if (idx_sig >= 0 && idx_sig < nf) {
-				ret[i] += f[idx_sig] * g[j];
-			}
+		size_t jmax = std::min(ng, nf - i);
+		for (size_t j = 0; j < jmax; j++) {
+			ret[i] += f[i + j] * g[j];
 		}
 	}
 }
 
+//ret[i] += sum of f[(i + j) % nf] * g[j], i < f.size()
 template <class T>
 static void correlateCircular1D(std::vector<T> &f, std::vector <T> &g,
 	std::vector<T> &ret) {
 	size_t nf = f.size();
 	size_t ng = g.size();
 	for (size_t i = 0; i < nf; i++) {
-		for (size_t j = 0; j < nf; j++) {
-			size_t idx_kern = (i + j) % ng;
-			ret[i] += f[j] * g[idx_kern];
+		for (size_t j = 0; j < ng; j++) {
+			size_t idx_sig = (i + j) % nf;
+			ret[i] += f[idx_sig] * g[j];
+		}
+	}
+}
+
+/*
+ * The full cross-correlation r[lag] = sum of f[n + lag] * g[n] holds
+ * nf + ng - 1 lags from -(ng - 1) to nf - 1, out[i] is the lag
+ * i - (ng - 1). A peak at lag L means g shows up in f at offset L.
+ */
+template <class T>
+static void correlate_direct(const T *f, size_t nf, const T *g, size_t ng,
+	T *out)
+{
+	std::fill(out, out + nf + ng - 1, T(0));
+	//out[i + ng - 1 - j] += f[i] * g[j], a convolution with g reversed
+	for (size_t j = 0; j < ng; j++) {
+		T y = g[j];
+		T *dst = out + ng - 1 - j;
+		for (size_t i = 0; i < nf; i++) {
+			dst[i] += f[i] * y;
+		}
+	}
+}
+
+/*
+ * Full cross-correlation through real FFTs: the inverse transform of
+ * F * conj(G) is the circular correlation, which holds every linear
+ * lag when padded to nf + ng - 1. Negative lags wrap to the end.
+ */
+template <class T>
+static void correlate_fft(const T *f, size_t nf, const T *g, size_t ng,
+	T *out)
+{
+	size_t n = convolution_fft_size(nf, ng);
+	size_t bins = n / 2 + 1;
+	RealFftPlan<T> &plan = rfft_cached_plan<T>(n, FFT_UNNORMALIZED);
+
+	std::vector<T> buf(n, T(0));
+	std::vector<std::complex<T> > fs(bins), gs(bins);
+
+	std::copy(f, f + nf, buf.begin());
+	plan.forward(buf.data(), fs.data());
+	std::fill(buf.begin(), buf.end(), T(0));
+	std::copy(g, g + ng, buf.begin());
+	plan.forward(buf.data(), gs.data());
+
+	const T scale = T(1) / n;
+	for (size_t k = 0; k < bins; k++) {
+		fs[k] = complex_mul(fs[k], std::conj(gs[k])) * scale;
+	}
+	plan.inverse(fs.data(), buf.data());
+
+	std::copy(buf.end() - (ng - 1), buf.end(), out);
+	std::copy(buf.begin(), buf.begin() + nf, out + ng - 1);
+}
+
+//full cross-correlation, CONV_AUTO picks like convolve()
+template <class T>
+static void correlate(const T *f, size_t nf, const T *g, size_t ng, T *out,
+	ConvolutionMethod method = CONV_AUTO)
+{
+	if (!nf || !ng) {
+		return;
+	}
+	if (method == CONV_AUTO) {
+		method = convolution_method(nf, ng);
+	}
+	if (method == CONV_FFT) {
+		correlate_fft(f, nf, g, ng, out);
+	}
+	else {
+		correlate_direct(f, nf, g, ng, out);
+	}
+}
+
+template <class T>
+static void correlate(const std::vector<T> &f, const std::vector<T> &g,
+	std::vector<T> &ret, ConvolutionMethod method = CONV_AUTO)
+{
+	ret.resize(f.empty() || g.empty() ? 0 : f.size() + g.size() - 1);
+	correlate(f.data(), f.size(), g.data(), g.size(), ret.data(), method);
+}
+
+/*
+ * r / sqrt(ef * eg) clamped to [-1, 1], or 0 when an energy is below
+ * 1e-12 of its scale: what is left there is cancellation in a running
+ * sum, not signal. Each energy is compared with one of its own kind so
+ * the test holds for samples of any range.
+ */
+static inline double correlation_ncc(double r, double ef, double ef_scale,
+	double eg, double eg_scale)
+{
+	if (!(ef > 1e-12 * ef_scale) || !(eg > 1e-12 * eg_scale)) {
+		return 0;
+	}
+	double ncc = r / sqrt(ef * eg);
+	return ncc > 1 ? 1 : ncc < -1 ? -1 : ncc;
+}
+
+/*
+ * Turns a full cross-correlation of f and g into the normalized one,
+ * r[lag] / sqrt(energy of the part of f under g * energy of g), so
+ * that a scaled copy of g in f scores 1 wherever it is. The energy
+ * of the sliding part of f is a running sum, lags where f or g is
+ * silent get 0.
+ */
+template <class T>
+static void correlate_normalize(const T *f, size_t nf, const T *g, size_t ng,
+	T *corr)
+{
+	double eg = 0;
+	for (size_t j = 0; j < ng; j++) {
+		eg += static_cast<double>(g[j]) * g[j];
+	}
+
+	//prefix sums of f^2, the window of lag L is f[max(L, 0), min(L + ng, nf))
+	std::vector<double> energy(nf + 1, 0);
+	for (size_t i = 0; i < nf; i++) {
+		energy[i + 1] = energy[i] + static_cast<double>(f[i]) * f[i];
+	}
+
+	for (size_t i = 0; i < nf + ng - 1; i++) {
+		ptrdiff_t lag = static_cast<ptrdiff_t>(i) - static_cast<ptrdiff_t>(ng - 1);
+		size_t start = lag < 0 ? 0 : lag;
+		size_t end = std::min(nf, static_cast<size_t>(lag + ng));
+		corr[i] = static_cast<T>(correlation_ncc(corr[i],
+			energy[end] - energy[start], energy[nf], eg, eg));
+	}
+}
+
+struct CorrelationPeak {
+	//with the sub-sample offset of the parabola through the neighbours
+	double lag;
+	//the sampled score at the peak, not the parabola's height
+	double value;
+};
+
+static inline bool correlation_peak_greater(const CorrelationPeak &a,
+	const CorrelationPeak &b)
+{
+	return a.value > b.value;
+}
+
+/*
+ * Adds the local maximum y at lag to the min-heap of the k best peaks.
+ * The lag is refined by the parabola through the neighbours ym and yp
+ * when there are both, the value stays the sampled y (at most 1 for
+ * normalized scores). A normalized neighbour of exactly 0 is one that
+ * correlation_ncc() found silent, not a score: a parabola through it
+ * would pull the lag up to half a sample toward the silence, so such a
+ * peak keeps its whole lag. Neighbours whose window only partly covers
+ * a burst are scored but still lopsided, short templates at the edge
+ * of one get a lag off by a fraction of a sample.
+ */
+static inline void correlation_peak_add(std::vector<CorrelationPeak> &peaks,
+	size_t k, double lag, double ym, double y, double yp, bool neighbours,
+	bool normalized = false)
+{
+	if (normalized && y > 1) {
+		y = 1;
+	}
+	if (peaks.size() == k && y <= peaks.front().value) {
+		return;
+	}
+
+	CorrelationPeak peak;
+	peak.lag = lag;
+	peak.value = y;
+	bool silent = normalized && (ym == 0 || yp == 0);
+	if (neighbours && !silent) {
+		double curve = ym - 2.0 * y + yp;
+		if (curve < 0) {
+			peak.lag += 0.5 * (ym - yp) / curve;
 		}
 	}
+
+	if (peaks.size() == k) {
+		std::pop_heap(peaks.begin(), peaks.end(), correlation_peak_greater);
+		peaks.back() = peak;
+	}
+	else {
+		peaks.push_back(peak);
+	}
+	std::push_heap(peaks.begin(), peaks.end(), correlation_peak_greater);
 }
 
+/*
+ * The k largest local maxima of corr, strongest first. corr[i] is the
+ * lag first_lag + i. Every peak lag is refined by the parabola through
+ * it and its neighbours, normalized says corr holds NCC scores.
+ */
+template <class T>
+static void correlation_peaks(const T *corr, size_t n, ptrdiff_t first_lag,
+	size_t k, std::vector<CorrelationPeak> &peaks, bool normalized = false)
+{
+	peaks.clear();
+	if (!k || !n) {
+		return;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		T y = corr[i];
+		if ((i && corr[i - 1] > y) || (i + 1 < n && corr[i + 1] >= y)) {
+			continue;
+		}
+		bool neighbours = i && i + 1 < n;
+		correlation_peak_add(peaks, k,
+			static_cast<double>(first_lag + static_cast<ptrdiff_t>(i)),
+			neighbours ? corr[i - 1] : 0, y,
+			neighbours ? corr[i + 1] : 0, neighbours, normalized);
+	}
+	std::sort_heap(peaks.begin(), peaks.end(), correlation_peak_greater);
+}
+
+/*
+ * Where g shows up in f: the k strongest lags of the cross-correlation,
+ * energy normalized when normalized is set.
+ */
+template <class T>
+static void correlate_peaks(const T *f, size_t nf, const T *g, size_t ng,
+	size_t k, std::vector<CorrelationPeak> &peaks, bool normalized = false,
+	ConvolutionMethod method = CONV_AUTO)
+{
+	peaks.clear();
+	if (!nf || !ng) {
+		return;
+	}
+	std::vector<T> corr(nf + ng - 1);
+	correlate(f, nf, g, ng, corr.data(), method);
+	if (normalized) {
+		correlate_normalize(f, nf, g, ng, corr.data());
+	}
+	correlation_peaks(corr.data(), corr.size(),
+		-static_cast<ptrdiff_t>(ng - 1), k, peaks, normalized);
+}
+
+//spectrum bins multiplied into every template before moving on, so
+//the tile of the signal spectrum stays in L1
+#ifndef CORRBANK_TILE
+	#define CORRBANK_TILE 256
+#endif
+
+/*
+ * Matched filter bank: one stream against many fixed templates.
+ * Blocks are overlap-save like in BlockConvolver, sized for the longest
+ * template. Each block is transformed once, and the conjugate template
+ * spectra (1 / N folded in) sit in one contiguous table. The products
+ * are formed a tile of bins at a time across all templates, then each
+ * template gets one inverse transform. The work per sample grows with
+ * templates * log(block), not with the template length.
+ *
+ * Every template keeps its k strongest local maxima over the stream.
+ * A peak's lag is the signal position where the template starts, with
+ * the parabolic sub-sample offset. Only positions where the whole
+ * template lies inside the signal are scored. With normalized set the
+ * scores are NCC, using one prefix sum of the block energy shared by
+ * all templates.
+ */
+template <class T>
+class CorrelatorBank {
+protected:
+	struct Template {
+		size_t length;
+		double norm;
+		//a min-heap, sorted by peaks()
+		std::vector<CorrelationPeak> peaks;
+		//the last two scores, the newer one is not judged yet
+		T older;
+		T newer;
+		size_t seen;
+	};
+
+	size_t mK;
+	bool mNormalized;
+	size_t mLongest;
+	size_t mSize;
+	size_t mBlock;
+	size_t mBins;
+	RealFftPlan<T> mPlan;
+	std::vector<Template> mTemplates;
+	//template t's spectrum at t * mBins
+	std::vector<std::complex<T> > mSpectra;
+	std::vector<std::complex<T> > mProducts;
+	std::vector<std::complex<T> > mSpectrum;
+
+	//longest - 1 old inputs then the block being filled
+	std::vector<T> mInput;
+	size_t mFill;
+	//samples in all the blocks transformed so far
+	size_t mConsumed;
+	std::vector<T> mWork;
+	std::vector<double> mEnergy;
+
+	static size_t longest(const std::vector<std::vector<T> > &templates) {
+		size_t n = 1;
+		for (size_t t = 0; t < templates.size(); t++) {
+			n = std::max(n, templates[t].size());
+		}
+		return n;
+	}
+
+	//judges the previous score now that its right neighbour is known
+	void score(Template &t, T y) {
+		if (t.seen >= 1 && t.newer > y && (t.seen == 1 || t.older <= t.newer)) {
+			correlation_peak_add(t.peaks, mK, static_cast<double>(t.seen - 1),
+				t.older, t.newer, y, t.seen >= 2, mNormalized);
+		}
+		t.older = t.newer;
+		t.newer = y;
+		t.seen++;
+	}
+
+	//the first count inputs of the block are real, the rest padding
+	void process_block(size_t count) {
+		mPlan.forward(mInput.data(), mSpectrum.data());
+
+		for (size_t k0 = 0; k0 < mBins; k0 += CORRBANK_TILE) {
+			size_t k1 = std::min(mBins, k0 + CORRBANK_TILE);
+			for (size_t t = 0; t < mTemplates.size(); t++) {
+				const std::complex<T> *s = mSpectra.data() + t * mBins;
+				std::complex<T> *p = mProducts.data() + t * mBins;
+				for (size_t k = k0; k < k1; k++) {
+					p[k] = complex_mul(mSpectrum[k], s[k]);
+				}
+			}
+		}
+
+		if (mNormalized) {
+			mEnergy[0] = 0;
+			for (size_t i = 0; i < mSize; i++) {
+				mEnergy[i + 1] = mEnergy[i] +
+					static_cast<double>(mInput[i]) * mInput[i];
+			}
+		}
+
+		for (size_t t = 0; t < mTemplates.size(); t++) {
+			Template &tp = mTemplates[t];
+			mPlan.inverse(mProducts.data() + t * mBins, mWork.data());
+
+			//mWork[m] scores position mConsumed - (mLongest - 1) + m, the
+			//block completes the positions mConsumed - length + 1 + i
+			size_t offset = mLongest - tp.length;
+			size_t skip = mConsumed + 1 < tp.length ?
+				std::min(count, tp.length - 1 - mConsumed) : 0;
+			for (size_t i = skip; i < count; i++) {
+				size_t m = offset + i;
+				T y = mWork[m];
+				if (mNormalized) {
+					double eg = tp.norm * tp.norm;
+					y = static_cast<T>(correlation_ncc(y,
+						mEnergy[m + tp.length] - mEnergy[m], mEnergy[mSize],
+						eg, eg));
+				}
+				score(tp, y);
+			}
+		}
+
+		mConsumed += count;
+		std::copy(mInput.end() - (mLongest - 1), mInput.end(), mInput.begin());
+		mFill = 0;
+	}
+
+public:
+	/*
+	 * k peaks are kept per template, size is the transform size as in
+	 * BlockConvolver: 0 picks the one with the least work per sample
+	 * for the longest template.
+	 */
+	CorrelatorBank(const std::vector<std::vector<T> > &templates, size_t k = 1,
+		bool normalized = false, size_t size = 0)
+		: mK(k), mNormalized(normalized), mLongest(longest(templates)),
+		mSize(block_fft_size(mLongest, size)),
+		mBlock(mSize - mLongest + 1), mBins(mSize / 2 + 1),
+		mPlan(mSize, FFT_UNNORMALIZED), mTemplates(templates.size()),
+		mSpectra(templates.size() * mBins),
+		mProducts(templates.size() * mBins), mSpectrum(mBins),
+		mInput(mSize, T(0)), mWork(mSize), mEnergy(mSize + 1)
+	{
+		const T scale = T(1) / mSize;
+		for (size_t t = 0; t < templates.size(); t++) {
+			const std::vector<T> &g = templates[t];
+			Template &tp = mTemplates[t];
+			tp.length = std::max<size_t>(g.size(), 1);
+			tp.norm = 0;
+			for (size_t j = 0; j < g.size(); j++) {
+				tp.norm += static_cast<double>(g[j]) * g[j];
+			}
+			tp.norm = sqrt(tp.norm);
+
+			std::fill(mWork.begin(), mWork.end(), T(0));
+			std::copy(g.begin(), g.end(), mWork.begin());
+			std::complex<T> *s = mSpectra.data() + t * mBins;
+			mPlan.forward(mWork.data(), s);
+			for (size_t b = 0; b < mBins; b++) {
+				s[b] = std::conj(s[b]) * scale;
+			}
+		}
+		reset();
+	}
+
+	inline size_t templates() const {
+		return mTemplates.size();
+	}
+
+	inline size_t fft_size() const {
+		return mSize;
+	}
+
+	//inputs per transform
+	inline size_t block_size() const {
+		return mBlock;
+	}
+
+	void push(const T *in, size_t count) {
+		while (count) {
+			size_t n = std::min(count, mBlock - mFill);
+			std::copy(in, in + n, mInput.begin() + mLongest - 1 + mFill);
+			mFill += n;
+			in += n;
+			count -= n;
+			if (mFill == mBlock) {
+				process_block(mBlock);
+			}
+		}
+	}
+
+	//scores the partial block and the last position, the end of the stream
+	void flush() {
+		if (mFill) {
+			size_t count = mFill;
+			std::fill(mInput.begin() + mLongest - 1 + mFill, mInput.end(), T(0));
+			process_block(count);
+		}
+		for (size_t t = 0; t < mTemplates.size(); t++) {
+			Template &tp = mTemplates[t];
+			if (tp.seen && (tp.seen == 1 || tp.older <= tp.newer)) {
+				correlation_peak_add(tp.peaks, mK,
+					static_cast<double>(tp.seen - 1), 0, tp.newer, 0, false,
+					mNormalized);
+			}
+			//nothing left to judge
+			tp.seen = 0;
+		}
+	}
+
+	//the k strongest peaks of template t so far, strongest first
+	void peaks(size_t t, std::vector<CorrelationPeak> &out) const {
+		out = mTemplates[t].peaks;
+		std::sort_heap(out.begin(), out.end(), correlation_peak_greater);
+	}
+
+	void reset() {
+		std::fill(mInput.begin(), mInput.end(), T(0));
+		mFill = 0;
+		mConsumed = 0;
+		for (size_t t = 0; t < mTemplates.size(); t++) {
+			mTemplates[t].peaks.clear();
+			mTemplates[t].older = mTemplates[t].newer = T(0);
+			mTemplates[t].seen = 0;
+		}
+	}
+};
+
+/*
+ * Cross-correlation of two streams over a sliding window,
+ * r[lag] = sum of x[n] * y[n - lag] for the last window samples n and
+ * lags 0 to max_lag, updated every hop samples.
+ *
+ * Recomputing the window costs window * max_lag per hop. Instead every
+ * hop adds the products of its own samples, a block correlation of hop
+ * by hop + max_lag samples done directly or by FFT as convolve() would
+ * pick, and subtracts those of the hop leaving the window. The hop
+ * products are kept in a ring of window / hop slots, so leaving takes
+ * exactly what arriving added, and the window energies are running
+ * sums the same way. The double sums still round at every add and
+ * subtract: after loud input they keep a residue of around 1e-12 of
+ * the largest window energy seen, even when the window is silent, so
+ * the queries treat anything below that floor as 0.
+ *
+ * Per hop the work is O((hop + max_lag) log(hop + max_lag)) or
+ * hop * max_lag, whichever is less, and does not grow with the window.
+ * Nothing is allocated after construction.
+ */
+template <class T>
+class SlidingCorrelator {
+protected:
+	size_t mWindow;
+	size_t mLag;
+	size_t mHop;
+	size_t mBlocks;
+
+	//max_lag old samples, then the window, then the hop being filled
+	//at mStart, moved back to the front when the buffer runs out
+	std::vector<T> mX;
+	std::vector<T> mY;
+	size_t mStart;
+	size_t mFill;
+	size_t mHops;
+
+	//per slot the products of one hop for every lag, then its x and y
+	//energy; their sums over the window
+	std::vector<double> mSlots;
+	std::vector<double> mSums;
+	//largest window energy so far, the rounding residue scales with it
+	double mPeak;
+
+	bool mUseFft;
+	size_t mSize;
+	RealFftPlan<T> mPlan;
+	std::vector<T> mWork;
+	std::vector<std::complex<T> > mXs;
+	std::vector<std::complex<T> > mYs;
+	//y energy per lag for the queries
+	mutable std::vector<double> mEnergy;
+
+	inline size_t stride() const {
+		return mLag + 3;
+	}
+
+	//products of the hop at x with y going max_lag further back
+	void hop_products(const T *x, const T *y, double *out) {
+		if (!mUseFft) {
+			for (size_t lag = 0; lag <= mLag; lag++) {
+				const T *yl = y + mLag - lag;
+				T acc = 0;
+				for (size_t i = 0; i < mHop; i++) {
+					acc += x[i] * yl[i];
+				}
+				out[lag] = acc;
+			}
+			return;
+		}
+
+		//the circular correlation of y with x holds lag at mLag - lag
+		size_t bins = mSize / 2 + 1;
+		std::fill(mWork.begin(), mWork.end(), T(0));
+		std::copy(y, y + mHop + mLag, mWork.begin());
+		mPlan.forward(mWork.data(), mYs.data());
+		std::fill(mWork.begin(), mWork.end(), T(0));
+		std::copy(x, x + mHop, mWork.begin());
+		mPlan.forward(mWork.data(), mXs.data());
+		const T scale = T(1) / mSize;
+		for (size_t k = 0; k < bins; k++) {
+			mYs[k] = complex_mul(mYs[k], std::conj(mXs[k])) * scale;
+		}
+		mPlan.inverse(mYs.data(), mWork.data());
+		for (size_t lag = 0; lag <= mLag; lag++) {
+			out[lag] = mWork[mLag - lag];
+		}
+	}
+
+	void process_hop() {
+		const T *x = mX.data() + mStart + mLag + mWindow;
+		const T *y = mY.data() + mStart + mWindow;
+		double *slot = mSlots.data() + (mHops % mBlocks) * stride();
+
+		for (size_t i = 0; i < stride(); i++) {
+			mSums[i] -= slot[i];
+		}
+		hop_products(x, y, slot);
+		double ex = 0, ey = 0;
+		for (size_t i = 0; i < mHop; i++) {
+			ex += static_cast<double>(x[i]) * x[i];
+			ey += static_cast<double>(y[mLag + i]) * y[mLag + i];
+		}
+		slot[mLag + 1] = ex;
+		slot[mLag + 2] = ey;
+		for (size_t i = 0; i < stride(); i++) {
+			mSums[i] += slot[i];
+		}
+		mPeak = std::max(mPeak, std::max(mSums[mLag + 1], mSums[mLag + 2]));
+
+		mHops++;
+		mFill = 0;
+		mStart += mHop;
+		if (mStart + mLag + mWindow + mHop > mX.size()) {
+			size_t keep = mLag + mWindow;
+			std::copy(mX.begin() + mStart, mX.begin() + mStart + keep, mX.begin());
+			std::copy(mY.begin() + mStart, mY.begin() + mStart + keep, mY.begin());
+			mStart = 0;
+		}
+	}
+
+	//sums at or below this are rounding residue
+	inline double residue_floor() const {
+		return 1e-12 * mPeak;
+	}
+
+	inline const T *window_y() const {
+		return mY.data() + mStart + mLag;
+	}
+
+	//energy of y[n - lag] over the window, lags 0 to max_lag
+	void y_energy(double *out) const {
+		const T *y = window_y();
+		double e = mSums[mLag + 2];
+		out[0] = e;
+		for (size_t lag = 1; lag <= mLag; lag++) {
+			double gone = y[mWindow - lag];
+			double come = y[-static_cast<ptrdiff_t>(lag)];
+			e += come * come - gone * gone;
+			out[lag] = e > 0 ? e : 0;
+		}
+	}
+
+public:
+	//the window is rounded up to whole hops
+	SlidingCorrelator(size_t window, size_t max_lag, size_t hop)
+		: mWindow(0), mLag(max_lag), mHop(std::max<size_t>(hop, 1)),
+		mBlocks((std::max<size_t>(window, 1) + mHop - 1) / mHop),
+		mStart(0), mFill(0), mHops(0),
+		mSlots(mBlocks * (max_lag + 3), 0), mSums(max_lag + 3, 0), mPeak(0),
+		mUseFft(convolution_method(mHop + mLag, mHop) == CONV_FFT),
+		mSize(mUseFft ? convolution_fft_size(mHop + mLag, mHop) : 2),
+		mPlan(mSize, FFT_UNNORMALIZED), mWork(mSize),
+		mXs(mSize / 2 + 1), mYs(mSize / 2 + 1), mEnergy(max_lag + 1)
+	{
+		mWindow = mBlocks * mHop;
+		//moving the history back once every (max_lag + window) / hop hops
+		size_t span = mLag + mWindow + mHop;
+		mX.assign(2 * span, T(0));
+		mY.assign(2 * span, T(0));
+	}
+
+	inline size_t window() const {
+		return mWindow;
+	}
+
+	inline size_t max_lag() const {
+		return mLag;
+	}
+
+	inline size_t hop() const {
+		return mHop;
+	}
+
+	//hops processed so far, the window is full from window / hop on
+	inline size_t hops() const {
+		return mHops;
+	}
+
+	inline bool ready() const {
+		return mHops >= mBlocks;
+	}
+
+	//the x window holds nothing above the rounding residue
+	inline bool silent() const {
+		return !(mSums[mLag + 1] > residue_floor());
+	}
+
+	/*
+	 * Adds count samples of both streams, returns the number of hops
+	 * completed. The results are those of the last hop, push one hop at
+	 * a time to see every one.
+	 */
+	size_t push(const T *x, const T *y, size_t count) {
+		size_t hops = 0;
+		while (count) {
+			size_t n = std::min(count, mHop - mFill);
+			size_t at = mStart + mLag + mWindow + mFill;
+			std::copy(x, x + n, mX.begin() + at);
+			std::copy(y, y + n, mY.begin() + at);
+			mFill += n;
+			x += n;
+			y += n;
+			count -= n;
+			if (mFill == mHop) {
+				process_hop();
+				hops++;
+			}
+		}
+		return hops;
+	}
+
+	//r[lag] for lags 0 to max_lag
+	void correlation(T *out) const {
+		for (size_t lag = 0; lag <= mLag; lag++) {
+			out[lag] = static_cast<T>(mSums[lag]);
+		}
+	}
+
+	//r[lag] / sqrt(energy of x * energy of y[n - lag]), 0 where silent
+	void normalized(T *out) const {
+		const double *ey = mEnergy.data();
+		y_energy(mEnergy.data());
+		double ex = mSums[mLag + 1];
+		for (size_t lag = 0; lag <= mLag; lag++) {
+			out[lag] = static_cast<T>(correlation_ncc(mSums[lag],
+				ex, mPeak, ey[lag], mPeak));
+		}
+	}
+
+	/*
+	 * sum of (x[n] - y[n - lag])^2, 0 where the streams line up and
+	 * where it is down at the rounding residue of the running sums
+	 */
+	void difference(T *out) const {
+		const double *ey = mEnergy.data();
+		y_energy(mEnergy.data());
+		double ex = mSums[mLag + 1];
+		for (size_t lag = 0; lag <= mLag; lag++) {
+			double d = ex + ey[lag] - 2 * mSums[lag];
+			out[lag] = d > residue_floor() ? static_cast<T>(d) : T(0);
+		}
+	}
+
+	void reset() {
+		std::fill(mX.begin(), mX.end(), T(0));
+		std::fill(mY.begin(), mY.end(), T(0));
+		std::fill(mSlots.begin(), mSlots.end(), 0);
+		std::fill(mSums.begin(), mSums.end(), 0);
+		mPeak = 0;
+		mStart = 0;
+		mFill = 0;
+		mHops = 0;
+	}
+};
+
+struct PitchEstimate {
+	//in Hz and in samples, with the parabolic sub-sample offset
+	double frequency;
+	double period;
+	//1 - the normalized difference at the period, 1 for a pure tone
+	double periodicity;
+};
+
+/*
+ * Sliding autocorrelation of one stream, r[lag] = sum of x[n] * x[n - lag]
+ * over the window, with YIN pitch estimation on top: the difference
+ * function d[lag] = sum of (x[n] - x[n - lag])^2 comes from r and the
+ * running energies, d'[lag] = d[lag] * lag / sum of d[1..lag] is the
+ * cumulative mean normalized one, and the period is the first local
+ * minimum of d' under threshold. The per-hop work is that of
+ * SlidingCorrelator, the estimate costs O(max_lag).
+ */
+template <class T>
+class SlidingAutocorrelator : public SlidingCorrelator<T> {
+protected:
+	std::vector<T> mDiff;
+
+public:
+	SlidingAutocorrelator(size_t window, size_t max_lag, size_t hop)
+		: SlidingCorrelator<T>(window, max_lag, hop), mDiff(max_lag + 1)
+	{
+	}
+
+	size_t push(const T *x, size_t count) {
+		return SlidingCorrelator<T>::push(x, x, count);
+	}
+
+	/*
+	 * Periods from min_lag to max_lag samples at rate Hz. Returns false
+	 * when nothing is periodic enough, the estimate then holds the best
+	 * candidate, and for a silent window, where the estimate stays 0.
+	 */
+	bool pitch(double rate, PitchEstimate &est, size_t min_lag = 2,
+		double threshold = 0.15)
+	{
+		size_t max_lag = this->mLag;
+		est.frequency = 0;
+		est.period = 0;
+		est.periodicity = 0;
+		min_lag = std::max<size_t>(min_lag, 1);
+		if (!this->ready() || this->silent() || min_lag + 1 > max_lag) {
+			return false;
+		}
+
+		this->difference(mDiff.data());
+		T *d = mDiff.data();
+		d[0] = 1;
+		double sum = 0;
+		for (size_t lag = 1; lag <= max_lag; lag++) {
+			sum += d[lag];
+			d[lag] = sum > 0 ? static_cast<T>(d[lag] * lag / sum) : T(1);
+		}
+
+		size_t best = min_lag;
+		bool found = false;
+		for (size_t lag = min_lag; lag <= max_lag; lag++) {
+			if (d[lag] < threshold) {
+				while (lag + 1 <= max_lag && d[lag + 1] < d[lag]) {
+					lag++;
+				}
+				best = lag;
+				found = true;
+				break;
+			}
+			if (d[lag] < d[best]) {
+				best = lag;
+			}
+		}
+
+		double period = best;
+		double value = d[best];
+		if (best > 1 && best < max_lag) {
+			double ym = d[best - 1], yp = d[best + 1];
+			double curve = ym - 2.0 * value + yp;
+			if (curve > 0) {
+				double delta = 0.5 * (ym - yp) / curve;
+				period += delta;
+				value -= 0.25 * (ym - yp) * delta;
+			}
+		}
+		est.period = period;
+		est.frequency = rate / period;
+		est.periodicity = std::min(1.0, std::max(0.0, 1.0 - value));
+		return found;
+	}
+};
+
+//channel pairs whose products are formed together, bounds the buffer
+#ifndef GCCPHAT_PAIR_BATCH
+	#define GCCPHAT_PAIR_BATCH 16
+#endif
+
+struct ChannelDelay {
+	//channel first lags channel second by delay samples, sub-sample
+	//refined; value near 1 for a clean single path, near 0 for none
+	size_t first;
+	size_t second;
+	double delay;
+	double value;
+};
+
+/*
+ * Time delay estimation between the channels of a recording by GCC-PHAT,
+ * the generalized cross-correlation with the phase transform: the cross
+ * spectrum of two channels divided by its magnitude keeps only the phase,
+ * and its inverse transform peaks sharply at the delay even for
+ * reverberant, coloured signals.
+ *
+ * X_i conj(X_j) / |X_i conj(X_j)| is the product of the two spectra each
+ * divided by its own magnitude, so every channel of a block is
+ * transformed and whitened once, and each pair costs one multiply and
+ * one inverse transform. Pairs are multiplied in batches, a tile of bins
+ * at a time across the batch. Blocks are independent, delays are
+ * reported per block of interleaved frames.
+ */
+template <class T>
+class GccPhat {
+protected:
+	size_t mChannels;
+	size_t mBlock;
+	size_t mMaxDelay;
+	size_t mSize;
+	size_t mBins;
+	RealFftPlan<T> mPlan;
+	//whitened spectrum of channel c at c * mBins
+	std::vector<std::complex<T> > mSpectra;
+	std::vector<std::complex<T> > mProducts;
+	std::vector<T> mWork;
+	//lags -max_delay to max_delay
+	std::vector<T> mLags;
+	std::vector<CorrelationPeak> mPeak;
+
+public:
+	//max_delay of 0 searches every lag a block can hold
+	GccPhat(size_t channels, size_t block, size_t max_delay = 0)
+		: mChannels(channels), mBlock(std::max<size_t>(block, 1)),
+		mMaxDelay(max_delay && max_delay < mBlock ? max_delay : mBlock - 1),
+		mSize(convolution_fft_size(mBlock, mBlock)), mBins(mSize / 2 + 1),
+		mPlan(mSize, FFT_UNNORMALIZED),
+		mSpectra(channels * mBins), mProducts(GCCPHAT_PAIR_BATCH * mBins),
+		mWork(mSize), mLags(2 * mMaxDelay + 1)
+	{
+	}
+
+	inline size_t channels() const {
+		return mChannels;
+	}
+
+	inline size_t block_size() const {
+		return mBlock;
+	}
+
+	inline size_t max_delay() const {
+		return mMaxDelay;
+	}
+
+	inline size_t pairs() const {
+		return mChannels * (mChannels - 1) / 2;
+	}
+
+	/*
+	 * Up to block_size() interleaved frames, a short last block is zero
+	 * padded. delays gets one entry per pair, (0, 1), (0, 2) ... (1, 2) ...
+	 */
+	void process_block(const T *frames, size_t count,
+		std::vector<ChannelDelay> &delays)
+	{
+		count = std::min(count, mBlock);
+		delays.resize(pairs());
+
+		for (size_t c = 0; c < mChannels; c++) {
+			std::fill(mWork.begin(), mWork.end(), T(0));
+			for (size_t i = 0; i < count; i++) {
+				mWork[i] = frames[i * mChannels + c];
+			}
+			std::complex<T> *s = mSpectra.data() + c * mBins;
+			mPlan.forward(mWork.data(), s);
+			for (size_t k = 0; k < mBins; k++) {
+				T mag = std::abs(s[k]);
+				s[k] = mag > 0 ? s[k] / mag : std::complex<T>(0);
+			}
+		}
+
+		size_t first = 0, second = 1, pair = 0;
+		const T scale = T(1) / mSize;
+		while (pair < delays.size()) {
+			size_t batch = std::min<size_t>(GCCPHAT_PAIR_BATCH,
+				delays.size() - pair);
+
+			//the pairs of this batch, in order
+			size_t f = first, g = second;
+			for (size_t b = 0; b < batch; b++) {
+				delays[pair + b].first = f;
+				delays[pair + b].second = g;
+				if (++g == mChannels) {
+					f++;
+					g = f + 1;
+				}
+			}
+			first = f;
+			second = g;
+
+			for (size_t k0 = 0; k0 < mBins; k0 += CORRBANK_TILE) {
+				size_t k1 = std::min(mBins, k0 + CORRBANK_TILE);
+				for (size_t b = 0; b < batch; b++) {
+					const std::complex<T> *x = mSpectra.data() +
+						delays[pair + b].first * mBins;
+					const std::complex<T> *y = mSpectra.data() +
+						delays[pair + b].second * mBins;
+					std::complex<T> *p = mProducts.data() + b * mBins;
+					for (size_t k = k0; k < k1; k++) {
+						p[k] = complex_mul(x[k], std::conj(y[k])) * scale;
+					}
+				}
+			}
+
+			for (size_t b = 0; b < batch; b++) {
+				ChannelDelay &d = delays[pair + b];
+				mPlan.inverse(mProducts.data() + b * mBins, mWork.data());
+				//negative lags wrapped to the end
+				std::copy(mWork.end() - mMaxDelay, mWork.end(), mLags.begin());
+				std::copy(mWork.begin(), mWork.begin() + mMaxDelay + 1,
+					mLags.begin() + mMaxDelay);
+				correlation_peaks(mLags.data(), mLags.size(),
+					-static_cast<ptrdiff_t>(mMaxDelay), 1, mPeak);
+				d.delay = mPeak.empty() ? 0 : mPeak[0].lag;
+				d.value = mPeak.empty() ? 0 : mPeak[0].value;
+			}
+			pair += batch;
+		}
+	}
+};
+
 #endif
@@ -3,28 +3,95 @@
 
 #include <vector>
 #include <complex>
+#include <algorithm>
+#include <memory>
+#include <map>
 #include <math.h>
+#include <stdint.h>
 
 #ifndef M_PI
 	#define M_PI (acos(-1.0))
 #endif
 
 #include "bit_hacks.hh"
+#include "fft_codelet.hh"
 
-template <class T, size_t size, bool inverse>
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+#ifdef _OPENMP
+	#include <omp.h>
+	#define FFT_OMP(x) _Pragma(#x)
+#else
+	#define FFT_OMP(x)
+#endif
+
+static inline int fft_max_threads() {
+#ifdef _OPENMP
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+static inline int fft_thread_num() {
+#ifdef _OPENMP
+	return omp_get_thread_num();
+#else
+	return 0;
+#endif
+}
+
+//FFT_AUTO plans sizes from here on with the four-step algorithm
+//when there is more than one thread to run it
+#ifndef FFT_FOUR_STEP_MIN_SIZE
+	#define FFT_FOUR_STEP_MIN_SIZE (1 << 22)
+#endif
+//columns gathered at once into a tile by the four-step column pass
+#define FFT_COLUMN_BLOCK 8
+//transforms run side by side by FftBatchPlan
+#ifndef FFT_BATCH_LANES
+	#define FFT_BATCH_LANES 8
+#endif
+//larger batched power-of-two sizes run one transform at a time
+#ifndef FFT_BATCH_MAX_INTERLEAVED
+	#define FFT_BATCH_MAX_INTERLEAVED (1 << 12)
+#endif
+
+//scaling of the transforms, the default scales the inverse by 1 / size
+enum FftNormalization {
+	FFT_NORMALIZE_INVERSE,
+	//neither direction is scaled, for callers folding 1 / size elsewhere
+	FFT_UNNORMALIZED,
+};
+
+template <class T>
+inline void fft(std::complex<T> *arr, size_t size, bool inverse,
+	FftNormalization normalization = FFT_NORMALIZE_INVERSE);
+
+template <class T, size_t size, bool inverse,
+	FftNormalization normalization = FFT_NORMALIZE_INVERSE>
 inline void fft(std::complex<T> *arr) {
+	const bool normalize = inverse && normalization == FFT_NORMALIZE_INVERSE;
 	size_t pwr = next_power_of_two(size);
 
 	if (size <= 1) {
 		return;
 	}
 
-	//FIXME: who should handle this?
+	//small powers of two run a straight-line codelet
+	if (FftFixed<T, size, inverse, normalize>::apply(arr)) {
+		return;
+	}
+
+	//mixed radix and Bluestein sizes go through a plan
 	if (size != pwr) {
+		fft<T>(arr, size, inverse, normalization);
 		return;
 	}
 
-	bitreversal_permutation(arr, size);
+	bitreversal_auto(arr, size, (const size_t*)NULL);
 	
 	for (size_t step_size = 2; step_size <= size; step_size <<= 1) {
 		std::complex<T> w(1, 0);
@@ -43,42 +110,1687 @@ inline void fft(std::complex<T> *arr) {
 				std::complex<T> odd = w * arr[idx_odd];
 				arr[idx_odd] = arr[idx_even] - odd;
 				arr[idx_even] = arr[idx_even] + odd;
-				
-				if (inverse) {
-					arr[idx_even] /= 2;
-					arr[idx_odd] /= 2;
-				}
 			}
 			w *= wn;
 		}
 	}
+
+	//the inverse is scaled once instead of halving every stage
+	if (normalize) {
+		const T scale = static_cast<T>(1) / static_cast<T>(size);
+		for (size_t i = 0; i < size; i++) {
+			arr[i] *= scale;
+		}
+	}
+}
+
+template <class T>
+static inline std::complex<T> complex_mul(const std::complex<T> &a,
+	const std::complex<T> &b)
+{
+	//plain product, std::complex operator* guards against NaN/Inf
+	//with a libcall unless -ffast-math is given
+	return std::complex<T>(a.real() * b.real() - a.imag() * b.imag(),
+		a.real() * b.imag() + a.imag() * b.real());
+}
+
+template <class T>
+static inline std::complex<T> complex_from(const std::complex<long double> &x)
+{
+	return std::complex<T>(static_cast<T>(x.real()), static_cast<T>(x.imag()));
+}
+
+enum FftAlgorithm {
+	//pick from the size
+	FFT_AUTO,
+	//powers of two only
+	FFT_RADIX2,
+	FFT_RADIX4,
+	FFT_SPLIT_RADIX,
+	//Stockham autosort, sizes made of the factors 2, 3, 5 and 7
+	FFT_STOCKHAM,
+	FFT_MIXED_RADIX = FFT_STOCKHAM,
+	//any size
+	FFT_BLUESTEIN,
+	//composite sizes, split into rows and columns over threads
+	FFT_FOUR_STEP,
+};
+
+/*
+ * FftPlan keeps everything a transform of one size and direction needs,
+ * so that repeated transforms only run the butterflies.
+ * The algorithm is picked from the size unless one is asked for:
+ * -powers of two: in place radix-4 (one radix-2 stage for odd powers)
+ *  on bit-reversed input with per-stage twiddle tables.
+ *  The plain radix-2 loop is kept as the reference and split-radix
+ *  is available as well
+ * -sizes made of the factors 2, 3, 5 and 7: Stockham autosort with
+ *  radix 4, 2, 3, 5 and 7 stages, ping-ponging through a scratch buffer.
+ *  It reads and writes every stage in order and needs no bit-reversal,
+ *  which pays off for power-of-two sizes past the cache as well
+ * -any other size: Bluestein's chirp-z transform on top of a
+ *  power-of-two plan of at least 2 * size - 1 points
+ * -composite sizes from FFT_FOUR_STEP_MIN_SIZE on: the four-step
+ *  algorithm, size = rows * columns with column transforms, twiddles,
+ *  row transforms and a transpose, spread over OpenMP threads
+ * The inverse transform is scaled by 1/size like fft().
+ *
+ * Only execute_with() leaves the plan untouched, the other calls use
+ * the plan scratch buffers, so a plan must not be shared between
+ * threads for those.
+ */
+template <class T>
+class FftPlan {
+protected:
+	struct Stage {
+		size_t radix;
+		//length of the sub-transforms and stride at this stage
+		size_t length;
+		size_t stride;
+		//twiddles W_length^(j * t), j < length / radix, 0 < t < radix
+		size_t twiddle_offset;
+	};
+
+	size_t mSize;
+	bool mInverse;
+	FftNormalization mNormalization;
+	//FFT_AUTO when there is nothing to do
+	FftAlgorithm mAlgorithm;
+
+	//radix-2: twiddles of all stages, half_step h starts at h - 1
+	//radix-4: W^k, W^2k, W^3k for k < h of every stage with quarter h
+	//split radix: W_size^k for k < 3 * size / 4
+	//mixed radix: twiddles of all stages, see Stage
+	std::vector<std::complex<T> > mTwiddles;
+	std::vector<size_t> mBitrev;
+	std::vector<Stage> mStages;
+	//W_p^k for the generic radix stages
+	std::vector<std::complex<T> > mRoots;
+
+	//Bluestein: chirp exp(-+ i * pi * k^2 / size) and the spectrum
+	//of its conjugate, padded to the inner plan size
+	std::vector<std::complex<T> > mChirp;
+	std::vector<std::complex<T> > mChirpSpectrum;
+	std::unique_ptr<FftPlan<T> > mInnerForward;
+	std::unique_ptr<FftPlan<T> > mInnerInverse;
+
+	//four-step: transforms along the columns and along the rows
+	//mTwiddles holds W_size^r for r < columns and W_rows^q for q < rows
+	std::unique_ptr<FftPlan<T> > mColumnPlan;
+	std::unique_ptr<FftPlan<T> > mRowPlan;
+
+	//algorithm workspace and the gather buffer for strided data
+	std::vector<std::complex<T> > mWork;
+	std::vector<std::complex<T> > mScratch;
+
+	static bool smooth_size(size_t size) {
+		static const size_t radices[] = {2, 3, 5, 7};
+		for (size_t i = 0; i < 4; i++) {
+			while (size % radices[i] == 0) {
+				size /= radices[i];
+			}
+		}
+		return size == 1;
+	}
+
+	inline T direction() const {
+		return mInverse ? 1 : -1;
+	}
+
+	//the output is scaled by 1 / size
+	inline bool normalized() const {
+		return mInverse && mNormalization == FFT_NORMALIZE_INVERSE;
+	}
+
+	void scale(std::complex<T> *arr) const {
+		T scale = static_cast<T>(1) / static_cast<T>(mSize);
+		for (size_t i = 0; i < mSize; i++) {
+			arr[i] *= scale;
+		}
+	}
+
+	//log2(size) is odd
+	bool odd_power() const {
+		bool odd = false;
+		for (size_t s = 1; s < mSize; s <<= 1) {
+			odd = !odd;
+		}
+		return odd;
+	}
+
+	void init_power_of_two() {
+		size_t size = mSize;
+
+		if (mAlgorithm == FFT_RADIX2) {
+			mTwiddles.resize(size - 1);
+			for (size_t half_step = 1; half_step < size; half_step <<= 1) {
+				long double angle = direction() * M_PI / half_step;
+				for (size_t k = 0; k < half_step; k++) {
+					mTwiddles[half_step - 1 + k] = complex_from<T>(
+						std::polar<long double>(1, angle * k));
+				}
+			}
+		}
+		else if (mAlgorithm == FFT_RADIX4) {
+			for (size_t h = odd_power() ? 2 : 1; h < size; h *= 4) {
+				long double angle = direction() * M_PI / (2 * h);
+				for (size_t k = 0; k < h; k++) {
+					for (size_t t = 1; t <= 3; t++) {
+						mTwiddles.push_back(complex_from<T>(
+							std::polar<long double>(1, angle * k * t)));
+					}
+				}
+			}
+		}
+		else {
+			mTwiddles.resize(3 * size / 4);
+			long double angle = direction() * 2 * M_PI / size;
+			for (size_t k = 0; k < mTwiddles.size(); k++) {
+				mTwiddles[k] = complex_from<T>(
+					std::polar<long double>(1, angle * k));
+			}
+		}
+
+		mBitrev.resize(size);
+		for (size_t i = 0, j = 0; i < size; i++) {
+			mBitrev[i] = j;
+			size_t k = size >> 1;
+			while (k && k <= j) {
+				j -= k;
+				k >>= 1;
+			}
+			j += k;
+		}
+	}
+
+	void init_mixed_radix() {
+		std::vector<size_t> factors;
+		size_t rest = mSize;
+		while (rest % 4 == 0) {
+			factors.push_back(4);
+			rest /= 4;
+		}
+		static const size_t radices[] = {2, 3, 5, 7};
+		for (size_t i = 0; i < 4; i++) {
+			while (rest % radices[i] == 0) {
+				factors.push_back(radices[i]);
+				rest /= radices[i];
+			}
+		}
+
+		size_t length = mSize;
+		size_t stride = 1;
+		for (size_t i = 0; i < factors.size(); i++) {
+			Stage stage;
+			stage.radix = factors[i];
+			stage.length = length;
+			stage.stride = stride;
+			stage.twiddle_offset = mTwiddles.size();
+
+			size_t m = length / stage.radix;
+			long double angle = direction() * 2 * M_PI / length;
+			for (size_t j = 0; j < m; j++) {
+				for (size_t t = 1; t < stage.radix; t++) {
+					mTwiddles.push_back(complex_from<T>(
+						std::polar<long double>(1, angle * ((j * t) % length))));
+				}
+			}
+			mStages.push_back(stage);
+
+			length = m;
+			stride *= stage.radix;
+		}
+
+		mRoots.resize(7);
+		for (size_t k = 0; k < 7; k++) {
+			mRoots[k] = complex_from<T>(
+				std::polar<long double>(1, direction() * 2 * M_PI * k / 7));
+		}
+
+		mWork.resize(mSize);
+	}
+
+	void init_bluestein() {
+		size_t size = mSize;
+		size_t inner = next_power_of_two(2 * size - 1);
+
+		mChirp.resize(size);
+		for (size_t k = 0; k < size; k++) {
+			//k^2 mod 2 * size keeps the angle small for large k
+			unsigned long long k2 = (unsigned long long)k * k % (2 * size);
+			mChirp[k] = complex_from<T>(
+				std::polar<long double>(1, direction() * M_PI * k2 / size));
+		}
+
+		mInnerForward.reset(new FftPlan<T>(inner, false));
+		mInnerInverse.reset(new FftPlan<T>(inner, true, FFT_AUTO,
+			FFT_UNNORMALIZED));
+
+		//the 1/inner of the inner inverse and the 1/size of a normalized
+		//inverse are folded into the chirp spectrum
+		T norm = static_cast<T>(1) / static_cast<T>(inner);
+		if (normalized()) {
+			norm /= static_cast<T>(size);
+		}
+		mChirpSpectrum.assign(inner, std::complex<T>(0, 0));
+		mChirpSpectrum[0] = std::conj(mChirp[0]) * norm;
+		for (size_t k = 1; k < size; k++) {
+			mChirpSpectrum[k] = std::conj(mChirp[k]) * norm;
+			mChirpSpectrum[inner - k] = mChirpSpectrum[k];
+		}
+		//the inner plans may need workspace too, e.g. four-step past
+		//2^22 points, it follows the inner buffer
+		mWork.resize(inner + std::max(mInnerForward->workspace_size(),
+			mInnerInverse->workspace_size()));
+		mInnerForward->execute_with(mChirpSpectrum.data(), mWork.data());
+	}
+
+	inline bool bitreversed_input() const {
+		return mAlgorithm == FFT_RADIX2 || mAlgorithm == FFT_RADIX4;
+	}
+
+	void permute(std::complex<T> *arr) const {
+		bitreversal_auto(arr, mSize, mBitrev.data());
+	}
+
+	void radix2_butterflies(std::complex<T> *arr) const {
+		size_t size = mSize;
+		const std::complex<T> *tw = mTwiddles.data();
+
+		for (size_t half_step = 1; half_step < size; half_step <<= 1) {
+			const std::complex<T> *w = tw + half_step - 1;
+			size_t step_size = half_step << 1;
+
+			for (size_t start = 0; start < size; start += step_size) {
+				std::complex<T> *even = arr + start;
+				std::complex<T> *odd = even + half_step;
+
+				for (size_t k = 0; k < half_step; k++) {
+					std::complex<T> t = complex_mul(w[k], odd[k]);
+					odd[k] = even[k] - t;
+					even[k] += t;
+				}
+			}
+		}
+	}
+
+	/*
+	 * Radix-4 decimation in time. After the bit-reversal the four
+	 * sub-transforms of a block of 4 * h hold the input samples
+	 * congruent to 0, 2, 1 and 3 modulo 4, so each pass combines them
+	 * with three twiddle products per four points, half the passes of
+	 * radix-2.
+	 */
+	void radix4_butterflies(std::complex<T> *arr) const {
+		size_t size = mSize;
+		size_t h = 1;
+		T dir = direction();
+
+		if (odd_power()) {
+			for (size_t i = 0; i < size; i += 2) {
+				std::complex<T> a = arr[i];
+				arr[i] = a + arr[i + 1];
+				arr[i + 1] = a - arr[i + 1];
+			}
+			h = 2;
+		}
+
+		const std::complex<T> *tw = mTwiddles.data();
+		for (; h < size; tw += 3 * h, h *= 4) {
+			for (size_t start = 0; start < size; start += 4 * h) {
+				std::complex<T> *x0 = arr + start;
+				std::complex<T> *x1 = x0 + h;
+				std::complex<T> *x2 = x1 + h;
+				std::complex<T> *x3 = x2 + h;
+
+				for (size_t k = 0; k < h; k++) {
+					const std::complex<T> *w = tw + 3 * k;
+					std::complex<T> s0 = x0[k];
+					std::complex<T> t1 = complex_mul(x2[k], w[0]);
+					std::complex<T> t2 = complex_mul(x1[k], w[1]);
+					std::complex<T> t3 = complex_mul(x3[k], w[2]);
+
+					std::complex<T> a = s0 + t2;
+					std::complex<T> b = s0 - t2;
+					std::complex<T> c = t1 + t3;
+					std::complex<T> d = t1 - t3;
+					//rotate by W_4 = dir * i
+					d = std::complex<T>(-dir * d.imag(), dir * d.real());
+
+					x0[k] = a + c;
+					x1[k] = b + d;
+					x2[k] = a - c;
+					x3[k] = b - d;
+				}
+			}
+		}
+	}
+
+	/*
+	 * Split-radix decimation in frequency: the even outputs come from
+	 * a half size transform, the outputs 4k + 1 and 4k + 3 from two
+	 * quarter size ones. The output is left in bit-reversed order.
+	 * tw_stride maps W_n to the W_size table.
+	 */
+	void split_radix(std::complex<T> *x, size_t n, size_t tw_stride) const {
+		if (n < 4) {
+			if (n == 2) {
+				std::complex<T> a = x[0];
+				x[0] = a + x[1];
+				x[1] = a - x[1];
+			}
+			return;
+		}
+
+		size_t q = n / 4;
+		const std::complex<T> *w = mTwiddles.data();
+		T dir = direction();
+
+		for (size_t k = 0; k < q; k++) {
+			std::complex<T> a0 = x[k];
+			std::complex<T> a1 = x[k + q];
+			std::complex<T> a2 = x[k + 2 * q];
+			std::complex<T> a3 = x[k + 3 * q];
+
+			x[k] = a0 + a2;
+			x[k + q] = a1 + a3;
+
+			std::complex<T> d02 = a0 - a2;
+			std::complex<T> d13 = a1 - a3;
+			//rotate by W_4 = dir * i
+			std::complex<T> rot(-dir * d13.imag(), dir * d13.real());
+			x[k + 2 * q] = complex_mul(d02 + rot, w[k * tw_stride]);
+			x[k + 3 * q] = complex_mul(d02 - rot, w[3 * k * tw_stride]);
+		}
+
+		split_radix(x, 2 * q, 2 * tw_stride);
+		split_radix(x + 2 * q, q, 4 * tw_stride);
+		split_radix(x + 3 * q, q, 4 * tw_stride);
+	}
+
+	//power-of-two butterflies on bit-reversed input
+	void butterflies(std::complex<T> *arr) const {
+		if (mAlgorithm == FFT_RADIX2) {
+			radix2_butterflies(arr);
+		}
+		else {
+			radix4_butterflies(arr);
+		}
+
+		if (normalized()) {
+			scale(arr);
+		}
+	}
+
+	//b = DFT_p(a) for the radices of the Stockham stages
+	inline void small_dft(size_t p, const std::complex<T> *a,
+		std::complex<T> *b) const
+	{
+		T dir = direction();
+
+		switch (p) {
+		case 2:
+			b[0] = a[0] + a[1];
+			b[1] = a[0] - a[1];
+			break;
+		case 3: {
+			const T sin60 = static_cast<T>(0.86602540378443864676L);
+			std::complex<T> sum = a[1] + a[2];
+			std::complex<T> diff = (a[1] - a[2]) * (dir * sin60);
+			std::complex<T> t1 = a[0] - sum * static_cast<T>(0.5);
+			//t2 = i * diff
+			std::complex<T> t2(-diff.imag(), diff.real());
+			b[0] = a[0] + sum;
+			b[1] = t1 + t2;
+			b[2] = t1 - t2;
+			break;
+		}
+		case 4: {
+			std::complex<T> s02 = a[0] + a[2];
+			std::complex<T> d02 = a[0] - a[2];
+			std::complex<T> s13 = a[1] + a[3];
+			std::complex<T> d13 = a[1] - a[3];
+			//rotate by W_4 = dir * i
+			std::complex<T> rot(-dir * d13.imag(), dir * d13.real());
+			b[0] = s02 + s13;
+			b[1] = d02 + rot;
+			b[2] = s02 - s13;
+			b[3] = d02 - rot;
+			break;
+		}
+		case 5: {
+			const T c1 = static_cast<T>(0.30901699437494742410L);
+			const T c2 = static_cast<T>(-0.80901699437494742410L);
+			const T s1 = static_cast<T>(0.95105651629515357212L);
+			const T s2 = static_cast<T>(0.58778525229247312917L);
+			std::complex<T> t1 = a[1] + a[4];
+			std::complex<T> t2 = a[2] + a[3];
+			std::complex<T> t3 = a[1] - a[4];
+			std::complex<T> t4 = a[2] - a[3];
+			std::complex<T> r1 = a[0] + t1 * c1 + t2 * c2;
+			std::complex<T> r2 = a[0] + t1 * c2 + t2 * c1;
+			std::complex<T> i1 = (t3 * s1 + t4 * s2) * dir;
+			std::complex<T> i2 = (t3 * s2 - t4 * s1) * dir;
+			b[0] = a[0] + t1 + t2;
+			b[1] = r1 + std::complex<T>(-i1.imag(), i1.real());
+			b[4] = r1 - std::complex<T>(-i1.imag(), i1.real());
+			b[2] = r2 + std::complex<T>(-i2.imag(), i2.real());
+			b[3] = r2 - std::complex<T>(-i2.imag(), i2.real());
+			break;
+		}
+		default:
+			for (size_t t = 0; t < p; t++) {
+				std::complex<T> sum = a[0];
+				for (size_t r = 1; r < p; r++) {
+					sum += complex_mul(a[r], mRoots[(r * t) % p]);
+				}
+				b[t] = sum;
+			}
+			break;
+		}
+	}
+
+	/*
+	 * One decimation in frequency Stockham stage: with m = length / radix
+	 * y[q + stride * (radix * j + t)] =
+	 *     W_length^(j * t) * sum_r x[q + stride * (j + r * m)] * W_radix^(r * t)
+	 * Both x and y are walked in order, the output ends up in natural
+	 * order after the last stage without any reordering pass.
+	 */
+	template <size_t P>
+	void stockham_pass(const Stage &stage,
+		const std::complex<T> *x, std::complex<T> *y) const
+	{
+		size_t s = stage.stride;
+		size_t m = stage.length / P;
+		size_t in_step = s * m;
+		const std::complex<T> *tw = mTwiddles.data() + stage.twiddle_offset;
+
+		for (size_t j = 0; j < m; j++) {
+			const std::complex<T> *w = tw + j * (P - 1);
+			const std::complex<T> *in = x + s * j;
+			std::complex<T> *out = y + s * P * j;
+
+			for (size_t q = 0; q < s; q++) {
+				std::complex<T> a[P], b[P];
+				for (size_t r = 0; r < P; r++) {
+					a[r] = in[q + r * in_step];
+				}
+				small_dft(P, a, b);
+
+				out[q] = b[0];
+				for (size_t t = 1; t < P; t++) {
+					out[q + s * t] = complex_mul(b[t], w[t - 1]);
+				}
+			}
+		}
+	}
+
+	void stockham_stage(const Stage &stage,
+		const std::complex<T> *x, std::complex<T> *y) const
+	{
+		switch (stage.radix) {
+		case 2:
+			stockham_pass<2>(stage, x, y);
+			break;
+		case 3:
+			stockham_pass<3>(stage, x, y);
+			break;
+		case 4:
+			stockham_pass<4>(stage, x, y);
+			break;
+		case 5:
+			stockham_pass<5>(stage, x, y);
+			break;
+		default:
+			stockham_pass<7>(stage, x, y);
+			break;
+		}
+	}
+
+	void execute_mixed_radix(std::complex<T> *arr, std::complex<T> *work) const {
+		std::complex<T> *x = arr;
+		std::complex<T> *y = work;
+		for (size_t i = 0; i < mStages.size(); i++) {
+			stockham_stage(mStages[i], x, y);
+			std::swap(x, y);
+		}
+		if (x != arr) {
+			std::copy(x, x + mSize, arr);
+		}
+		if (normalized()) {
+			scale(arr);
+		}
+	}
+
+	//out of place, the buffers are picked so the last stage lands in out
+	void execute_mixed_radix(const std::complex<T> *in, std::complex<T> *out,
+		std::complex<T> *work) const
+	{
+		std::complex<T> *y = mStages.size() % 2 ? out : work;
+		std::complex<T> *z = mStages.size() % 2 ? work : out;
+		const std::complex<T> *x = in;
+		for (size_t i = 0; i < mStages.size(); i++) {
+			stockham_stage(mStages[i], x, y);
+			x = y;
+			std::swap(y, z);
+		}
+		if (mStages.empty()) {
+			std::copy(in, in + mSize, out);
+		}
+		if (normalized()) {
+			scale(out);
+		}
+	}
+
+	//largest divisor not above sqrt(size), 0 for primes
+	static size_t four_step_rows(size_t size) {
+		size_t rows = 0;
+		for (size_t d = 2; d * d <= size; d++) {
+			if (size % d == 0) {
+				rows = d;
+			}
+		}
+		return rows;
+	}
+
+	void init_four_step(size_t rows) {
+		size_t columns = mSize / rows;
+		mColumnPlan.reset(new FftPlan<T>(rows, mInverse, FFT_AUTO,
+			mNormalization));
+		mRowPlan.reset(new FftPlan<T>(columns, mInverse, FFT_AUTO,
+			mNormalization));
+
+		//W_size^(c * r) = W_size^(a mod columns) * W_rows^(a / columns)
+		mTwiddles.resize(columns + rows);
+		for (size_t i = 0; i < columns; i++) {
+			mTwiddles[i] = complex_from<T>(std::polar<long double>(1,
+				direction() * 2 * M_PI * i / mSize));
+		}
+		for (size_t i = 0; i < rows; i++) {
+			mTwiddles[columns + i] = complex_from<T>(std::polar<long double>(1,
+				direction() * 2 * M_PI * i / rows));
+		}
+
+		mWork.resize(mSize);
+	}
+
+	/*
+	 * The data is a rows x columns matrix, x[columns * n1 + n2].
+	 * Column transforms over n1 are followed by the twiddles
+	 * W_size^(n2 * k1), row transforms over n2 and a transpose giving
+	 * X[k1 + rows * k2]. The columns are gathered a few at a time into
+	 * a per-thread tile so that they are read a cache line at a time.
+	 */
+	void execute_four_step(std::complex<T> *arr, std::complex<T> *work) const {
+		const FftPlan<T> &column_plan = *mColumnPlan;
+		const FftPlan<T> &row_plan = *mRowPlan;
+		const size_t rows = column_plan.size();
+		const size_t columns = row_plan.size();
+		const size_t block = FFT_COLUMN_BLOCK;
+		const std::complex<T> *low = mTwiddles.data();
+		const std::complex<T> *high = low + columns;
+
+		FFT_OMP(omp parallel)
+		{
+			std::vector<std::complex<T> > tile(block * rows);
+			std::vector<std::complex<T> > sub(std::max(
+				column_plan.workspace_size(), row_plan.workspace_size()));
+
+			FFT_OMP(omp for schedule(static))
+			for (ptrdiff_t b = 0; b < (ptrdiff_t)columns; b += block) {
+				size_t first = b;
+				size_t count = std::min(block, columns - first);
+
+				for (size_t r = 0; r < rows; r++) {
+					const std::complex<T> *src = arr + columns * r + first;
+					for (size_t c = 0; c < count; c++) {
+						tile[rows * c + r] = src[c];
+					}
+				}
+
+				for (size_t c = 0; c < count; c++) {
+					std::complex<T> *col = tile.data() + rows * c;
+					column_plan.execute_with(col, sub.data());
+
+					//a = n2 * k1 mod size kept as q * columns + r
+					size_t n2 = first + c;
+					size_t q = 0, r = 0;
+					for (size_t k1 = 1; k1 < rows; k1++) {
+						r += n2;
+						if (r >= columns) {
+							r -= columns;
+							q++;
+						}
+						std::complex<T> w = complex_mul(low[r], high[q]);
+						col[k1] = complex_mul(col[k1], w);
+					}
+				}
+
+				for (size_t r = 0; r < rows; r++) {
+					std::complex<T> *dst = arr + columns * r + first;
+					for (size_t c = 0; c < count; c++) {
+						dst[c] = tile[rows * c + r];
+					}
+				}
+			}
+
+			FFT_OMP(omp for schedule(static))
+			for (ptrdiff_t r = 0; r < (ptrdiff_t)rows; r++) {
+				row_plan.execute_with(arr + columns * r, sub.data());
+			}
+
+			//work[rows * k2 + k1] = arr[columns * k1 + k2] in tiles
+			const size_t tile_size = 32;
+			FFT_OMP(omp for schedule(static))
+			for (ptrdiff_t t1 = 0; t1 < (ptrdiff_t)rows; t1 += tile_size) {
+				size_t k1_end = std::min(rows, (size_t)t1 + tile_size);
+				for (size_t t2 = 0; t2 < columns; t2 += tile_size) {
+					size_t k2_end = std::min(columns, t2 + tile_size);
+					for (size_t k1 = t1; k1 < k1_end; k1++) {
+						for (size_t k2 = t2; k2 < k2_end; k2++) {
+							work[rows * k2 + k1] = arr[columns * k1 + k2];
+						}
+					}
+				}
+			}
+
+			FFT_OMP(omp for schedule(static))
+			for (ptrdiff_t r = 0; r < (ptrdiff_t)columns; r++) {
+				std::copy(work + rows * r, work + rows * (r + 1),
+					arr + rows * r);
+			}
+		}
+	}
+
+	void execute_bluestein(const std::complex<T> *in, std::complex<T> *out,
+		std::complex<T> *work) const
+	{
+		size_t size = mSize;
+		size_t inner = mChirpSpectrum.size();
+
+		for (size_t k = 0; k < size; k++) {
+			work[k] = complex_mul(in[k], mChirp[k]);
+		}
+		std::fill(work + size, work + inner, std::complex<T>(0, 0));
+
+		mInnerForward->execute_with(work, work + inner);
+		for (size_t k = 0; k < inner; k++) {
+			work[k] = complex_mul(work[k], mChirpSpectrum[k]);
+		}
+		mInnerInverse->execute_with(work, work + inner);
+
+		for (size_t k = 0; k < size; k++) {
+			out[k] = complex_mul(work[k], mChirp[k]);
+		}
+	}
+
+public:
+	FftPlan(size_t size, bool inverse, FftAlgorithm algorithm = FFT_AUTO,
+		FftNormalization normalization = FFT_NORMALIZE_INVERSE)
+		: mSize(size), mInverse(inverse), mNormalization(normalization),
+		mAlgorithm(FFT_AUTO)
+	{
+		if (!size) {
+			return;
+		}
+
+		size_t rows = 0;
+		if (algorithm == FFT_FOUR_STEP ||
+			(algorithm == FFT_AUTO && size >= FFT_FOUR_STEP_MIN_SIZE
+			&& fft_max_threads() > 1))
+		{
+			rows = four_step_rows(size);
+		}
+
+		if (rows) {
+			mAlgorithm = FFT_FOUR_STEP;
+			init_four_step(rows);
+		}
+		else if (size == next_power_of_two(size) && algorithm != FFT_BLUESTEIN
+			&& algorithm != FFT_STOCKHAM)
+		{
+			switch (algorithm) {
+			case FFT_RADIX2:
+			case FFT_SPLIT_RADIX:
+				mAlgorithm = algorithm;
+				break;
+			default:
+				mAlgorithm = FFT_RADIX4;
+				break;
+			}
+			init_power_of_two();
+		}
+		else if (smooth_size(size) && algorithm != FFT_BLUESTEIN) {
+			mAlgorithm = FFT_STOCKHAM;
+			init_mixed_radix();
+		}
+		else {
+			mAlgorithm = FFT_BLUESTEIN;
+			init_bluestein();
+		}
+	}
+
+	inline size_t size() const {
+		return mSize;
+	}
+
+	inline bool inverse() const {
+		return mInverse;
+	}
+
+	inline FftNormalization normalization() const {
+		return mNormalization;
+	}
+
+	inline FftAlgorithm algorithm() const {
+		return mAlgorithm;
+	}
+
+	//number of elements the work buffer of execute_with() must hold
+	inline size_t workspace_size() const {
+		return mWork.size();
+	}
+
+	//in place transform, work holds workspace_size() elements
+	void execute_with(std::complex<T> *arr, std::complex<T> *work) const {
+		switch (mAlgorithm) {
+		case FFT_RADIX2:
+		case FFT_RADIX4:
+			permute(arr);
+			butterflies(arr);
+			break;
+		case FFT_SPLIT_RADIX:
+			split_radix(arr, mSize, 1);
+			permute(arr);
+			if (normalized()) {
+				scale(arr);
+			}
+			break;
+		case FFT_STOCKHAM:
+			execute_mixed_radix(arr, work);
+			break;
+		case FFT_BLUESTEIN:
+			execute_bluestein(arr, arr, work);
+			break;
+		case FFT_FOUR_STEP:
+			execute_four_step(arr, work);
+			break;
+		default:
+			break;
+		}
+	}
+
+	//in place transform
+	void execute(std::complex<T> *arr) {
+		execute_with(arr, mWork.data());
+	}
+
+	//out of place transform
+	void execute(const std::complex<T> *in, std::complex<T> *out) {
+		switch (mAlgorithm) {
+		case FFT_RADIX2:
+		case FFT_RADIX4:
+			//reorder while copying
+			for (size_t i = 0; i < mSize; i++) {
+				out[mBitrev[i]] = in[i];
+			}
+			butterflies(out);
+			break;
+		case FFT_STOCKHAM:
+			execute_mixed_radix(in, out, mWork.data());
+			break;
+		case FFT_BLUESTEIN:
+			execute_bluestein(in, out, mWork.data());
+			break;
+		default:
+			std::copy(in, in + mSize, out);
+			execute_with(out, mWork.data());
+			break;
+		}
+	}
+
+	//transform of the elements data[0], data[stride], data[2 * stride]...
+	void execute_strided(std::complex<T> *data, size_t stride) {
+		if (mAlgorithm == FFT_AUTO) {
+			return;
+		}
+
+		//only allocated once strided data shows up
+		mScratch.resize(mSize);
+		std::complex<T> *tmp = mScratch.data();
+		if (bitreversed_input()) {
+			//reorder while gathering
+			for (size_t i = 0; i < mSize; i++) {
+				tmp[mBitrev[i]] = data[stride * i];
+			}
+			butterflies(tmp);
+		}
+		else {
+			for (size_t i = 0; i < mSize; i++) {
+				tmp[i] = data[stride * i];
+			}
+			execute_with(tmp, mWork.data());
+		}
+		for (size_t i = 0; i < mSize; i++) {
+			data[stride * i] = tmp[i];
+		}
+	}
+};
+
+/*
+ * RealFftPlan transforms an even number of real samples through one complex
+ * transform of size / 2: even samples go to the real and odd samples
+ * to the imaginary part, and the two half spectra are separated
+ * afterwards. Only the size / 2 + 1 non-redundant bins are stored,
+ * the rest are their complex conjugates.
+ */
+template <class T>
+class RealFftPlan {
+protected:
+	size_t mSize;
+	FftNormalization mNormalization;
+	FftPlan<T> mForward;
+	FftPlan<T> mInverse;
+	//exp(-2 * pi * i * k / size) for k in [0, size / 4]
+	std::vector<std::complex<T> > mTwiddles;
+
+public:
+	RealFftPlan(size_t size,
+		FftNormalization normalization = FFT_NORMALIZE_INVERSE)
+		: mSize(size), mNormalization(normalization),
+		mForward(size / 2, false),
+		mInverse(size / 2, true, FFT_AUTO, normalization),
+		mTwiddles(size / 4 + 1)
+	{
+		for (size_t k = 0; k < mTwiddles.size(); k++) {
+			std::complex<long double> w =
+				std::polar<long double>(1, -2 * M_PI * k / size);
+			mTwiddles[k] = std::complex<T>(
+				static_cast<T>(w.real()), static_cast<T>(w.imag()));
+		}
+	}
+
+	inline size_t size() const {
+		return mSize;
+	}
+
+	inline FftNormalization normalization() const {
+		return mNormalization;
+	}
+
+	//size real samples to size / 2 + 1 bins
+	void forward(const T *in, std::complex<T> *out) {
+		size_t half = mSize / 2;
+		if (!half) {
+			return;
+		}
+
+		mForward.execute(reinterpret_cast<const std::complex<T>*>(in), out);
+
+		std::complex<T> z0 = out[0];
+		out[0] = std::complex<T>(z0.real() + z0.imag(), 0);
+		out[half] = std::complex<T>(z0.real() - z0.imag(), 0);
+
+		for (size_t k = 1; k <= half / 2; k++) {
+			std::complex<T> a = out[k];
+			std::complex<T> b = std::conj(out[half - k]);
+			std::complex<T> even = (a + b) * static_cast<T>(0.5);
+			std::complex<T> diff = (a - b) * static_cast<T>(0.5);
+			//odd = -i * diff
+			std::complex<T> odd(diff.imag(), -diff.real());
+			std::complex<T> t = complex_mul(mTwiddles[k], odd);
+			out[k] = even + t;
+			out[half - k] = std::conj(even - t);
+		}
+	}
+
+	//size / 2 + 1 bins to size real samples, scaled by 1/size unless
+	//the plan is unnormalized
+	void inverse(const std::complex<T> *in, T *out) {
+		size_t half = mSize / 2;
+		if (!half) {
+			return;
+		}
+
+		std::complex<T> *buf = reinterpret_cast<std::complex<T>*>(out);
+		//unnormalized the half size inverse gives size / 2, the rest is here
+		T h = mNormalization == FFT_UNNORMALIZED ? 1 : static_cast<T>(0.5);
+
+		T x0 = in[0].real();
+		T xh = in[half].real();
+		buf[0] = std::complex<T>((x0 + xh) * h, (x0 - xh) * h);
+
+		for (size_t k = 1; k <= half / 2; k++) {
+			std::complex<T> a = in[k];
+			std::complex<T> b = std::conj(in[half - k]);
+			std::complex<T> even = (a + b) * h;
+			std::complex<T> odd = complex_mul((a - b) * h,
+				std::conj(mTwiddles[k]));
+			//even + i * odd and its mirror
+			buf[k] = std::complex<T>(even.real() - odd.imag(),
+				even.imag() + odd.real());
+			buf[half - k] = std::complex<T>(even.real() + odd.imag(),
+				odd.real() - even.imag());
+		}
+
+		mInverse.execute(buf);
+	}
+};
+
+//size must be even, out holds size / 2 + 1 bins
+template <class T, size_t size>
+inline void rfft(const T *in, std::complex<T> *out) {
+	static thread_local RealFftPlan<T> plan(size);
+	plan.forward(in, out);
+}
+
+template <class T, size_t size,
+	FftNormalization normalization = FFT_NORMALIZE_INVERSE>
+inline void irfft(const std::complex<T> *in, T *out) {
+	static thread_local RealFftPlan<T> plan(size, normalization);
+	plan.inverse(in, out);
+}
+
+//per-thread plans for the runtime sized transforms
+template <class T>
+inline FftPlan<T> &fft_cached_plan(size_t size, bool inverse,
+	FftNormalization normalization = FFT_NORMALIZE_INVERSE)
+{
+	typedef std::map<std::pair<size_t, int>,
+		std::unique_ptr<FftPlan<T> > > PlanMap;
+	static thread_local PlanMap plans;
+
+	int key = 2 * normalization + inverse;
+	std::unique_ptr<FftPlan<T> > &plan = plans[std::make_pair(size, key)];
+	if (!plan) {
+		plan.reset(new FftPlan<T>(size, inverse, FFT_AUTO, normalization));
+	}
+	return *plan;
+}
+
+//runtime sized transform, any size
+template <class T>
+inline void fft(std::complex<T> *arr, size_t size, bool inverse,
+	FftNormalization normalization)
+{
+	fft_cached_plan<T>(size, inverse, normalization).execute(arr);
+}
+
+//per-thread real plans, size must be even
+template <class T>
+inline RealFftPlan<T> &rfft_cached_plan(size_t size,
+	FftNormalization normalization = FFT_NORMALIZE_INVERSE)
+{
+	typedef std::map<std::pair<size_t, int>,
+		std::unique_ptr<RealFftPlan<T> > > PlanMap;
+	static thread_local PlanMap plans;
+
+	std::unique_ptr<RealFftPlan<T> > &plan =
+		plans[std::make_pair(size, (int)normalization)];
+	if (!plan) {
+		plan.reset(new RealFftPlan<T>(size, normalization));
+	}
+	return *plan;
+}
+
+/*
+ * Smallest size >= size with no prime factors but 2, 3 and 5, what
+ * zero padded transforms should be padded to. Sizes with factors of 7
+ * are supported as well but run two to three times slower per
+ * element here, so padding a bit further is cheaper.
+ */
+static inline size_t fft_fast_size(size_t size) {
+	size_t best = next_power_of_two(size);
+	for (size_t p5 = 1; p5 < best; p5 *= 5) {
+		for (size_t p3 = p5; p3 < best; p3 *= 3) {
+			size_t n = p3;
+			while (n < size) {
+				n *= 2;
+			}
+			best = std::min(best, n);
+		}
+	}
+	return best;
+}
+
+/*
+ * Many transforms of the same size. Transform b of a batch reads
+ * element k from data[batch_stride * b + stride * k].
+ *
+ * Power-of-two sizes up to FFT_BATCH_MAX_INTERLEAVED are gathered
+ * FFT_BATCH_LANES transforms at a time into a tile of split real and
+ * imaginary parts with element k of every transform next to each
+ * other. The radix-4 butterflies then run across the lanes so that
+ * one twiddle load serves all of them and the inner loops vectorize.
+ * Other sizes go one transform at a time through an FftPlan, strided
+ * ones gathered into the same tile.
+ */
+template <class T>
+class FftBatchPlan {
+protected:
+	FftPlan<T> mPlan;
+	bool mInterleaved;
+	//per radix-4 stage and k: w1, w2, w3 as re, im pairs
+	std::vector<T> mTwiddles;
+	std::vector<size_t> mBitrev;
+	std::vector<std::complex<T> > mWork;
+
+	bool odd_power() const {
+		bool odd = false;
+		for (size_t s = 1; s < mPlan.size(); s <<= 1) {
+			odd = !odd;
+		}
+		return odd;
+	}
+
+	void init_interleaved() {
+		size_t size = mPlan.size();
+		long double dir = mPlan.inverse() ? 1 : -1;
+
+		for (size_t h = odd_power() ? 2 : 1; h < size; h *= 4) {
+			long double angle = dir * M_PI / (2 * h);
+			for (size_t k = 0; k < h; k++) {
+				for (size_t t = 1; t <= 3; t++) {
+					std::complex<long double> w =
+						std::polar<long double>(1, angle * k * t);
+					mTwiddles.push_back(w.real());
+					mTwiddles.push_back(w.imag());
+				}
+			}
+		}
+
+		mBitrev.resize(size);
+		for (size_t i = 0, j = 0; i < size; i++) {
+			mBitrev[i] = j;
+			size_t k = size >> 1;
+			while (k && k <= j) {
+				j -= k;
+				k >>= 1;
+			}
+			j += k;
+		}
+	}
+
+	/*
+	 * One radix-4 butterfly on every lane, r and i are the real and
+	 * imaginary rows of the four inputs. The rows never overlap, the
+	 * restrict parameters let the lane loop vectorize.
+	 */
+	static void butterfly4(T *__restrict__ r0, T *__restrict__ r1,
+		T *__restrict__ r2, T *__restrict__ r3, T *__restrict__ i0,
+		T *__restrict__ i1, T *__restrict__ i2, T *__restrict__ i3,
+		const T *w, T dir)
+	{
+		T w1r = w[0], w1i = w[1];
+		T w2r = w[2], w2i = w[3];
+		T w3r = w[4], w3i = w[5];
+
+		for (size_t j = 0; j < FFT_BATCH_LANES; j++) {
+			T s0r = r0[j], s0i = i0[j];
+			T t1r = r2[j] * w1r - i2[j] * w1i;
+			T t1i = r2[j] * w1i + i2[j] * w1r;
+			T t2r = r1[j] * w2r - i1[j] * w2i;
+			T t2i = r1[j] * w2i + i1[j] * w2r;
+			T t3r = r3[j] * w3r - i3[j] * w3i;
+			T t3i = r3[j] * w3i + i3[j] * w3r;
+
+			T ar = s0r + t2r, ai = s0i + t2i;
+			T br = s0r - t2r, bi = s0i - t2i;
+			T cr = t1r + t3r, ci = t1i + t3i;
+			//(t1 - t3) rotated by W_4 = dir * i
+			T dr = -dir * (t1i - t3i), di = dir * (t1r - t3r);
+
+			r0[j] = ar + cr;
+			i0[j] = ai + ci;
+			r1[j] = br + dr;
+			i1[j] = bi + di;
+			r2[j] = ar - cr;
+			i2[j] = ai - ci;
+			r3[j] = br - dr;
+			i3[j] = bi - di;
+		}
+	}
+
+	void interleaved_butterflies(T *re, T *im) const {
+		const size_t L = FFT_BATCH_LANES;
+		size_t size = mPlan.size();
+		size_t h = 1;
+		T dir = mPlan.inverse() ? 1 : -1;
+
+		if (odd_power()) {
+			for (size_t i = 0; i < size * L; i += 2 * L) {
+				for (size_t j = i; j < i + L; j++) {
+					T ar = re[j], ai = im[j];
+					re[j] = ar + re[j + L];
+					im[j] = ai + im[j + L];
+					re[j + L] = ar - re[j + L];
+					im[j + L] = ai - im[j + L];
+				}
+			}
+			h = 2;
+		}
+
+		const T *tw = mTwiddles.data();
+		for (; h < size; tw += 6 * h, h *= 4) {
+			size_t hl = h * L;
+			for (size_t start = 0; start < size; start += 4 * h) {
+				for (size_t k = 0; k < h; k++) {
+					T *x0 = re + (start + k) * L;
+					T *y0 = im + (start + k) * L;
+					butterfly4(x0, x0 + hl, x0 + 2 * hl, x0 + 3 * hl,
+						y0, y0 + hl, y0 + 2 * hl, y0 + 3 * hl, tw + 6 * k, dir);
+				}
+			}
+		}
+	}
+
+	//up to FFT_BATCH_LANES transforms side by side
+	void execute_interleaved(std::complex<T> *data, size_t count,
+		size_t stride, size_t batch_stride, std::complex<T> *work) const
+	{
+		const size_t L = FFT_BATCH_LANES;
+		size_t size = mPlan.size();
+		T *re = reinterpret_cast<T*>(work);
+		T *im = re + size * L;
+
+		for (size_t k = 0; k < size; k++) {
+			const std::complex<T> *src = data + stride * mBitrev[k];
+			T *kr = re + L * k;
+			T *ki = im + L * k;
+			for (size_t j = 0; j < count; j++) {
+				kr[j] = src[batch_stride * j].real();
+				ki[j] = src[batch_stride * j].imag();
+			}
+			for (size_t j = count; j < L; j++) {
+				kr[j] = ki[j] = 0;
+			}
+		}
+
+		interleaved_butterflies(re, im);
+
+		T scale = mPlan.inverse() &&
+			mPlan.normalization() == FFT_NORMALIZE_INVERSE ? T(1) / size : T(1);
+		for (size_t k = 0; k < size; k++) {
+			std::complex<T> *dst = data + stride * k;
+			const T *kr = re + L * k;
+			const T *ki = im + L * k;
+			for (size_t j = 0; j < count; j++) {
+				dst[batch_stride * j] =
+					std::complex<T>(kr[j] * scale, ki[j] * scale);
+			}
+		}
+	}
+
+	//up to FFT_BATCH_LANES strided transforms through a tile
+	void execute_tiled(std::complex<T> *data, size_t count,
+		size_t stride, size_t batch_stride, std::complex<T> *work) const
+	{
+		size_t size = mPlan.size();
+		std::complex<T> *tile = work;
+		std::complex<T> *sub = work + size * FFT_BATCH_LANES;
+
+		for (size_t k = 0; k < size; k++) {
+			const std::complex<T> *src = data + stride * k;
+			for (size_t j = 0; j < count; j++) {
+				tile[size * j + k] = src[batch_stride * j];
+			}
+		}
+		for (size_t j = 0; j < count; j++) {
+			mPlan.execute_with(tile + size * j, sub);
+		}
+		for (size_t k = 0; k < size; k++) {
+			std::complex<T> *dst = data + stride * k;
+			for (size_t j = 0; j < count; j++) {
+				dst[batch_stride * j] = tile[size * j + k];
+			}
+		}
+	}
+
+public:
+	FftBatchPlan(size_t size, bool inverse,
+		FftNormalization normalization = FFT_NORMALIZE_INVERSE) :
+		mPlan(size, inverse, FFT_AUTO, normalization),
+		mInterleaved(size >= 2 && size <= FFT_BATCH_MAX_INTERLEAVED &&
+			size == next_power_of_two(size))
+	{
+		if (mInterleaved) {
+			init_interleaved();
+		}
+	}
+
+	size_t size() const {
+		return mPlan.size();
+	}
+
+	bool inverse() const {
+		return mPlan.inverse();
+	}
+
+	FftNormalization normalization() const {
+		return mPlan.normalization();
+	}
+
+	//number of elements the work buffer of execute_with() must hold
+	size_t workspace_size() const {
+		return mPlan.size() * FFT_BATCH_LANES + mPlan.workspace_size();
+	}
+
+	//work holds workspace_size() elements, the plan is left untouched
+	void execute_with(std::complex<T> *data, size_t count, size_t stride,
+		size_t batch_stride, std::complex<T> *work) const
+	{
+		for (size_t b = 0; b < count; b += FFT_BATCH_LANES) {
+			size_t lanes = std::min<size_t>(FFT_BATCH_LANES, count - b);
+			std::complex<T> *first = data + batch_stride * b;
+
+			if (mInterleaved) {
+				execute_interleaved(first, lanes, stride, batch_stride, work);
+			}
+			else if (stride == 1) {
+				std::complex<T> *sub = work + mPlan.size() * FFT_BATCH_LANES;
+				for (size_t j = 0; j < lanes; j++) {
+					mPlan.execute_with(first + batch_stride * j, sub);
+				}
+			}
+			else {
+				execute_tiled(first, lanes, stride, batch_stride, work);
+			}
+		}
+	}
+
+	void execute(std::complex<T> *data, size_t count, size_t stride,
+		size_t batch_stride)
+	{
+		mWork.resize(workspace_size());
+		execute_with(data, count, stride, batch_stride, mWork.data());
+	}
+};
+
+//per-thread batch plans for fft_batch
+template <class T>
+inline FftBatchPlan<T> &fft_cached_batch_plan(size_t size, bool inverse,
+	FftNormalization normalization = FFT_NORMALIZE_INVERSE)
+{
+	typedef std::map<std::pair<size_t, int>,
+		std::unique_ptr<FftBatchPlan<T> > > PlanMap;
+	static thread_local PlanMap plans;
+
+	int key = 2 * normalization + inverse;
+	std::unique_ptr<FftBatchPlan<T> > &plan =
+		plans[std::make_pair(size, key)];
+	if (!plan) {
+		plan.reset(new FftBatchPlan<T>(size, inverse, normalization));
+	}
+	return *plan;
+}
+
+//count transforms of size elements, see FftBatchPlan
+template <class T>
+inline void fft_batch(std::complex<T> *data, size_t size, size_t count,
+	size_t stride, size_t batch_stride, bool inverse,
+	FftNormalization normalization = FFT_NORMALIZE_INVERSE)
+{
+	fft_cached_batch_plan<T>(size, inverse, normalization).execute(data,
+		count, stride, batch_stride);
 }
 
 template <class T, size_t stride, size_t count, bool inverse>
 inline void fft_skip(std::complex<T> data[]) {
-	auto vec = new std::complex<T>[count];
+	fft_cached_plan<T>(count, inverse).execute_strided(data, stride);
+}
+
+/*
+ * 2D transform of a row major width x height matrix, columns first.
+ * Both passes are FftBatchPlan batches of FFT_BATCH_LANES columns or
+ * rows, so the columns are read a cache line at a time instead of one
+ * element per row. The workspace is allocated with the plan,
+ * executing does not allocate.
+ *
+ * With more than one thread (and OpenMP) the column blocks and then
+ * the row blocks are split between the threads, each with its own
+ * workspace. Every column and row is transformed exactly as in the
+ * serial case so the results are the same.
+ */
+template <class T>
+class Fft2dPlan {
+protected:
+	size_t mWidth;
+	size_t mHeight;
+	int mThreads;
+	FftBatchPlan<T> mRowPlan;
+	FftBatchPlan<T> mColumnPlan;
+	size_t mWorkSize;
+	//one workspace per thread
+	std::vector<std::complex<T> > mWork;
 
-	for (size_t i = 0; i < count; i++) {
-		vec[i] = data[stride * i];
+public:
+	Fft2dPlan(size_t width, size_t height, bool inverse, int threads = 1,
+		FftNormalization normalization = FFT_NORMALIZE_INVERSE) :
+		mWidth(width),
+		mHeight(height),
+		mThreads(0),
+		mRowPlan(width, inverse, normalization),
+		mColumnPlan(height, inverse, normalization),
+		mWorkSize(std::max(mRowPlan.workspace_size(),
+			mColumnPlan.workspace_size()))
+	{
+		set_threads(threads);
 	}
-	fft<T, count, inverse>(vec);
-	for (size_t i = 0; i < count; i++) {
-		data[stride * i] = vec[i];
+
+	size_t width() const {
+		return mWidth;
 	}
 
-	delete[] vec;
-}
+	size_t height() const {
+		return mHeight;
+	}
 
-template<class T, size_t width, size_t height, bool inverse>
-inline void fft_2d(std::complex<T> *data) {
-	for (size_t i = 0; i < width; i++) {
-		//vertical direction
-		fft_skip<T, width, height, inverse>(data + i);
+	bool inverse() const {
+		return mRowPlan.inverse();
+	}
+
+	FftNormalization normalization() const {
+		return mRowPlan.normalization();
+	}
+
+	int threads() const {
+		return mThreads;
 	}
-	for (size_t i = 0; i < height; i++) {
-		//horizontal direction
-		fft_skip<T, 1, width, inverse>(data + width * i);
+
+	//threads < 1 uses fft_max_threads()
+	void set_threads(int threads) {
+		if (threads < 1) {
+			threads = fft_max_threads();
+		}
+#ifndef _OPENMP
+		threads = 1;
+#endif
+		if (threads == mThreads) {
+			return;
+		}
+		mThreads = threads;
+		mWork.resize(mWorkSize * threads);
 	}
+
+	void execute(std::complex<T> *data) {
+		const ptrdiff_t width = mWidth;
+		const ptrdiff_t height = mHeight;
+		const ptrdiff_t block = FFT_BATCH_LANES;
+
+		FFT_OMP(omp parallel num_threads(mThreads) if(mThreads > 1))
+		{
+			std::complex<T> *work = mWork.data() + mWorkSize * fft_thread_num();
+
+			//vertical direction
+			FFT_OMP(omp for schedule(static))
+			for (ptrdiff_t i = 0; i < width; i += block) {
+				mColumnPlan.execute_with(data + i, std::min(block, width - i),
+					width, 1, work);
+			}
+			//the implicit barrier above lets the rows see every column
+
+			//horizontal direction
+			FFT_OMP(omp for schedule(static))
+			for (ptrdiff_t i = 0; i < height; i += block) {
+				mRowPlan.execute_with(data + width * i,
+					std::min(block, height - i), 1, width, work);
+			}
+		}
+	}
+};
+
+template<class T, size_t width, size_t height, bool inverse,
+	FftNormalization normalization = FFT_NORMALIZE_INVERSE>
+inline void fft_2d(std::complex<T> *data) {
+	static thread_local Fft2dPlan<T> plan(width, height, inverse, 1,
+		normalization);
+	plan.execute(data);
+}
+
+//threads < 1 uses fft_max_threads()
+template<class T>
+inline void fft_2d(std::complex<T> *data, size_t width, size_t height,
+	bool inverse, int threads = 1,
+	FftNormalization normalization = FFT_NORMALIZE_INVERSE)
+{
+	typedef std::map<std::pair<std::pair<size_t, size_t>, int>,
+		std::unique_ptr<Fft2dPlan<T> > > PlanMap;
+	static thread_local PlanMap plans;
+
+	int key = 2 * normalization + inverse;
+	std::unique_ptr<Fft2dPlan<T> > &plan =
+		plans[std::make_pair(std::make_pair(width, height), key)];
+	if (!plan) {
+		plan.reset(new Fft2dPlan<T>(width, height, inverse, threads,
+			normalization));
+	}
+	plan->set_threads(threads);
+	plan->execute(data);
 }
 
+//Q15 (int16_t) or Q31 (int32_t) complex sample
+template <class T>
+struct FixedComplex {
+	T re;
+	T im;
+};
+
+template <class T>
+struct FixedFftTraits;
+
+template <>
+struct FixedFftTraits<int16_t> {
+	typedef int32_t Wide;
+	enum { FRAC_BITS = 15 };
+};
+
+template <>
+struct FixedFftTraits<int32_t> {
+	typedef int64_t Wide;
+	enum { FRAC_BITS = 31 };
+};
+
+/*
+ * Radix-2 fixed-point FFT with block floating point scaling. Before
+ * every stage the block is checked, and when any component reaches a
+ * quarter of full scale that stage halves its outputs, which keeps the
+ * growth of a butterfly (up to 1 + sqrt(2)) in range. The butterflies
+ * saturate, so the worst case of a scaled stage clips instead of
+ * wrapping around. On SSE2 the int16_t stages run four butterflies at
+ * a time with pmaddwd products and saturating packs and adds.
+ * size must be a power of two.
+ */
+template <class T>
+class FixedFftPlan {
+protected:
+	typedef typename FixedFftTraits<T>::Wide Wide;
+	enum { FRAC_BITS = FixedFftTraits<T>::FRAC_BITS };
+
+	size_t mSize;
+	bool mInverse;
+	int mLog2;
+	std::vector<size_t> mBitrev;
+	//stage with half step h at 4 * (h - 1): (wr, -wi) pairs for the
+	//real part of b * w, then (wi, wr) pairs for the imaginary part
+	std::vector<T> mTwiddles;
+
+	static T saturate(Wide x) {
+		const Wide hi = (Wide(1) << FRAC_BITS) - 1;
+		return static_cast<T>(x > hi ? hi : x < -hi - 1 ? -hi - 1 : x);
+	}
+
+	//1 when any component is at a quarter of full scale or above
+	static int stage_shift(const FixedComplex<T> *x, size_t size) {
+		T bits = 0;
+		for (size_t i = 0; i < size; i++) {
+			bits |= x[i].re < 0 ? ~x[i].re : x[i].re;
+			bits |= x[i].im < 0 ? ~x[i].im : x[i].im;
+		}
+		return bits >= (T(1) << (FRAC_BITS - 2));
+	}
+
+	static void stage(FixedComplex<T> *x, size_t size, size_t h,
+		const T *wa, const T *wb, int shift)
+	{
+		const int bits = FRAC_BITS + shift;
+		const Wide round = Wide(1) << (bits - 1);
+
+		for (size_t start = 0; start < size; start += 2 * h) {
+			FixedComplex<T> *a = x + start;
+			FixedComplex<T> *b = a + h;
+			for (size_t k = 0; k < h; k++) {
+				Wide tr = ((Wide)b[k].re * wa[2 * k] +
+					(Wide)b[k].im * wa[2 * k + 1] + round) >> bits;
+				Wide ti = ((Wide)b[k].re * wb[2 * k] +
+					(Wide)b[k].im * wb[2 * k + 1] + round) >> bits;
+				Wide ar = a[k].re >> shift;
+				Wide ai = a[k].im >> shift;
+				a[k].re = saturate(ar + tr);
+				a[k].im = saturate(ai + ti);
+				b[k].re = saturate(ar - tr);
+				b[k].im = saturate(ai - ti);
+			}
+		}
+	}
+
+	//first stage, W = 1
+	static void stage_first(FixedComplex<T> *x, size_t size, int shift) {
+		for (size_t i = 0; i < size; i += 2) {
+			Wide ar = x[i].re, ai = x[i].im;
+			Wide br = x[i + 1].re, bi = x[i + 1].im;
+			x[i].re = saturate((ar + br) >> shift);
+			x[i].im = saturate((ai + bi) >> shift);
+			x[i + 1].re = saturate((ar - br) >> shift);
+			x[i + 1].im = saturate((ai - bi) >> shift);
+		}
+	}
+
+#ifdef __SSE2__
+	//four butterflies a time, h >= 4
+	static void stage_sse2(FixedComplex<int16_t> *x, size_t size, size_t h,
+		const int16_t *wa, const int16_t *wb, int shift)
+	{
+		const __m128i round = _mm_set1_epi32(1 << (FRAC_BITS - 1 + shift));
+		const __m128i bits = _mm_cvtsi32_si128(FRAC_BITS + shift);
+		const __m128i half = _mm_cvtsi32_si128(shift);
+
+		for (size_t start = 0; start < size; start += 2 * h) {
+			__m128i *a = reinterpret_cast<__m128i*>(x + start);
+			__m128i *b = reinterpret_cast<__m128i*>(x + start + h);
+			for (size_t k = 0; k < h; k += 4, a++, b++) {
+				__m128i vb = _mm_loadu_si128(b);
+				__m128i tr = _mm_madd_epi16(vb, _mm_loadu_si128(
+					reinterpret_cast<const __m128i*>(wa + 2 * k)));
+				__m128i ti = _mm_madd_epi16(vb, _mm_loadu_si128(
+					reinterpret_cast<const __m128i*>(wb + 2 * k)));
+				__m128i lo = _mm_unpacklo_epi32(tr, ti);
+				__m128i hi = _mm_unpackhi_epi32(tr, ti);
+				lo = _mm_sra_epi32(_mm_add_epi32(lo, round), bits);
+				hi = _mm_sra_epi32(_mm_add_epi32(hi, round), bits);
+				__m128i t = _mm_packs_epi32(lo, hi);
+
+				__m128i va = _mm_sra_epi16(_mm_loadu_si128(a), half);
+				_mm_storeu_si128(a, _mm_adds_epi16(va, t));
+				_mm_storeu_si128(b, _mm_subs_epi16(va, t));
+			}
+		}
+	}
+
+	void run_stage(FixedComplex<int16_t> *x, size_t h, const int16_t *wa,
+		const int16_t *wb, int shift) const
+	{
+		if (h >= 4) {
+			stage_sse2(x, mSize, h, wa, wb, shift);
+		}
+		else {
+			stage(x, mSize, h, wa, wb, shift);
+		}
+	}
+#endif
+
+	template <class U>
+	void run_stage(FixedComplex<U> *x, size_t h, const U *wa,
+		const U *wb, int shift) const
+	{
+		stage(x, mSize, h, wa, wb, shift);
+	}
+
+public:
+	FixedFftPlan(size_t size, bool inverse)
+		: mSize(size), mInverse(inverse), mLog2(0)
+	{
+		while ((size_t(1) << mLog2) < size) {
+			mLog2++;
+		}
+
+		mBitrev.resize(size);
+		for (size_t i = 0, j = 0; i < size; i++) {
+			mBitrev[i] = j;
+			size_t k = size >> 1;
+			while (k && k <= j) {
+				j -= k;
+				k >>= 1;
+			}
+			j += k;
+		}
+
+		//+-1 is stored as the largest value, -wi must not overflow
+		const long double one = (long double)((Wide(1) << FRAC_BITS) - 1);
+		long double dir = inverse ? 1 : -1;
+		mTwiddles.resize(size ? 4 * (size - 1) : 0);
+		for (size_t h = 1; h < size; h <<= 1) {
+			T *wa = mTwiddles.data() + 4 * (h - 1);
+			T *wb = wa + 2 * h;
+			for (size_t k = 0; k < h; k++) {
+				std::complex<long double> w =
+					std::polar<long double>(1, dir * M_PI * k / h);
+				T wr = static_cast<T>(floorl(w.real() * one + 0.5L));
+				T wi = static_cast<T>(floorl(w.imag() * one + 0.5L));
+				wa[2 * k] = wr;
+				wa[2 * k + 1] = -wi;
+				wb[2 * k] = wi;
+				wb[2 * k + 1] = wr;
+			}
+		}
+	}
+
+	inline size_t size() const {
+		return mSize;
+	}
+
+	inline bool inverse() const {
+		return mInverse;
+	}
+
+	/*
+	 * In place transform. Returns the block exponent e: the transform,
+	 * the inverse scaled by 1/size as usual, is data * 2^e.
+	 */
+	int execute(FixedComplex<T> *data) const {
+		int exponent = 0;
+
+		for (size_t i = 0; i < mSize; i++) {
+			size_t j = mBitrev[i];
+			if (i < j) {
+				std::swap(data[i], data[j]);
+			}
+		}
+
+		for (size_t h = 1; h < mSize; h <<= 1) {
+			int shift = stage_shift(data, mSize);
+			const T *wa = mTwiddles.data() + 4 * (h - 1);
+			if (h == 1) {
+				stage_first(data, mSize, shift);
+			}
+			else {
+				run_stage(data, h, wa, wa + 2 * h, shift);
+			}
+			exponent += shift;
+		}
+
+		return mInverse ? exponent - mLog2 : exponent;
+	}
+};
+
 #endif
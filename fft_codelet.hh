@@ -0,0 +1,215 @@
+#ifndef __FFT_CODELET_HH__
+#define __FFT_CODELET_HH__
+
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+/*
+ * Straight-line FFT kernels (codelets) for power-of-two sizes up to
+ * FFT_CODELET_MAX generated by the compiler. The radix-2 decimation in
+ * time recursion is a template so every sub-transform and butterfly
+ * is inlined, and the twiddles are constexpr values computed with a
+ * series at compile time: there are no loops and no trig calls left.
+ * Larger sizes use the codelets as leaves of the same recursion.
+ */
+
+#ifndef FFT_CODELET_MAX
+	#define FFT_CODELET_MAX 64
+#endif
+//largest size FftFixed runs through the codelets
+#ifndef FFT_FIXED_MAX
+	#define FFT_FIXED_MAX (1 << 16)
+#endif
+
+#define FFT_CODELET_INLINE inline __attribute__((always_inline))
+
+constexpr bool fft_codelet_available(size_t size) {
+	return size >= 2 && size <= FFT_FIXED_MAX && !(size & (size - 1));
+}
+
+//sum of the Taylor series of sin (term = x, n = 1) or cos (term = 1, n = 0)
+constexpr long double fft_codelet_series(long double x, long double term,
+	long double sum, int n)
+{
+	return n > 40 ? sum : fft_codelet_series(x,
+		-term * x * x / ((n + 1) * (n + 2)), sum + term, n + 2);
+}
+
+//2 * pi * k / n reduced to [-pi, pi] where the series converges fast
+constexpr long double fft_codelet_angle(size_t k, size_t n) {
+	return 2 * 3.141592653589793238462643383279502884L *
+		(2 * (k % n) > n ? (long double)(k % n) - n : (long double)(k % n)) / n;
+}
+
+constexpr long double fft_codelet_cos(size_t k, size_t n) {
+	return fft_codelet_series(fft_codelet_angle(k, n), 1, 0, 0);
+}
+
+constexpr long double fft_codelet_sin(size_t k, size_t n) {
+	return fft_codelet_series(fft_codelet_angle(k, n),
+		fft_codelet_angle(k, n), 0, 1);
+}
+
+//0: W^0 = 1, 1: W^(n/4) = -+i, 2: any other twiddle
+constexpr int fft_codelet_twiddle_kind(size_t n, size_t k) {
+	return k == 0 ? 0 : 4 * k == n ? 1 : 2;
+}
+
+//x * W_n^k, W_n = exp(-+2 * pi * i / n)
+template <class T, size_t n, size_t k, bool inverse,
+	int kind = fft_codelet_twiddle_kind(n, k)>
+struct FftCodeletTwiddle {
+	static FFT_CODELET_INLINE std::complex<T> apply(const std::complex<T> &x) {
+		constexpr T wr = fft_codelet_cos(k, n);
+		constexpr T wi = inverse ? fft_codelet_sin(k, n) : -fft_codelet_sin(k, n);
+		return std::complex<T>(x.real() * wr - x.imag() * wi,
+			x.real() * wi + x.imag() * wr);
+	}
+};
+
+template <class T, size_t n, size_t k, bool inverse>
+struct FftCodeletTwiddle<T, n, k, inverse, 0> {
+	static FFT_CODELET_INLINE std::complex<T> apply(const std::complex<T> &x) {
+		return x;
+	}
+};
+
+template <class T, size_t n, size_t k, bool inverse>
+struct FftCodeletTwiddle<T, n, k, inverse, 1> {
+	static FFT_CODELET_INLINE std::complex<T> apply(const std::complex<T> &x) {
+		return inverse ? std::complex<T>(-x.imag(), x.real()) :
+			std::complex<T>(x.imag(), -x.real());
+	}
+};
+
+//butterflies k .. n / 2 - 1 joining the two half size transforms in out
+template <class T, size_t n, size_t k, bool inverse, bool done = (2 * k == n)>
+struct FftCodeletCombine {
+	static FFT_CODELET_INLINE void apply(std::complex<T> *out) {
+		std::complex<T> a = out[k];
+		std::complex<T> b =
+			FftCodeletTwiddle<T, n, k, inverse>::apply(out[k + n / 2]);
+		out[k] = a + b;
+		out[k + n / 2] = a - b;
+		FftCodeletCombine<T, n, k + 1, inverse>::apply(out);
+	}
+};
+
+template <class T, size_t n, size_t k, bool inverse>
+struct FftCodeletCombine<T, n, k, inverse, true> {
+	static FFT_CODELET_INLINE void apply(std::complex<T> *) {
+	}
+};
+
+/*
+ * out[k] = sum over j of in[stride * j] * W_n^(j * k), not normalized.
+ * in and out must not overlap. Sizes above FFT_CODELET_MAX recurse
+ * down to the codelets and join the halves in a loop.
+ */
+template <class T, size_t n, bool inverse,
+	bool unrolled = (n <= FFT_CODELET_MAX)>
+struct FftCodelet {
+	//W_n^k for k < n / 2, computed once
+	static const std::complex<T> *twiddles() {
+		static const std::vector<std::complex<T> > table = []() {
+			std::vector<std::complex<T> > w(n / 2);
+			for (size_t k = 0; k < n / 2; k++) {
+				std::complex<long double> t = std::polar<long double>(1,
+					(inverse ? 2 : -2) * 3.141592653589793238462643383279502884L
+					* k / n);
+				w[k] = std::complex<T>(t.real(), t.imag());
+			}
+			return w;
+		}();
+		return table.data();
+	}
+
+	static void apply(const std::complex<T> *in, size_t stride,
+		std::complex<T> *out)
+	{
+		FftCodelet<T, n / 2, inverse>::apply(in, 2 * stride, out);
+		FftCodelet<T, n / 2, inverse>::apply(in + stride, 2 * stride,
+			out + n / 2);
+
+		const std::complex<T> *w = twiddles();
+		for (size_t k = 0; k < n / 2; k++) {
+			std::complex<T> a = out[k];
+			std::complex<T> x = out[k + n / 2];
+			std::complex<T> b(x.real() * w[k].real() - x.imag() * w[k].imag(),
+				x.real() * w[k].imag() + x.imag() * w[k].real());
+			out[k] = a + b;
+			out[k + n / 2] = a - b;
+		}
+	}
+};
+
+template <class T, size_t n, bool inverse>
+struct FftCodelet<T, n, inverse, true> {
+	static FFT_CODELET_INLINE void apply(const std::complex<T> *in,
+		size_t stride, std::complex<T> *out)
+	{
+		FftCodelet<T, n / 2, inverse>::apply(in, 2 * stride, out);
+		FftCodelet<T, n / 2, inverse>::apply(in + stride, 2 * stride,
+			out + n / 2);
+		FftCodeletCombine<T, n, 0, inverse>::apply(out);
+	}
+};
+
+template <class T, bool inverse>
+struct FftCodelet<T, 2, inverse, true> {
+	static FFT_CODELET_INLINE void apply(const std::complex<T> *in,
+		size_t stride, std::complex<T> *out)
+	{
+		std::complex<T> a = in[0];
+		std::complex<T> b = in[stride];
+		out[0] = a + b;
+		out[1] = a - b;
+	}
+};
+
+template <class T, bool inverse>
+struct FftCodelet<T, 1, inverse, true> {
+	static FFT_CODELET_INLINE void apply(const std::complex<T> *in,
+		size_t, std::complex<T> *out)
+	{
+		out[0] = in[0];
+	}
+};
+
+//in place fixed size transform, scaled by 1 / size when normalize is set
+template <class T, size_t size, bool inverse, bool normalize = inverse,
+	bool available = fft_codelet_available(size)>
+struct FftFixed {
+	//false when there is no codelet for the size
+	static bool apply(std::complex<T> *) {
+		return false;
+	}
+};
+
+template <class T, size_t size, bool inverse, bool normalize>
+struct FftFixed<T, size, inverse, normalize, true> {
+	static bool apply(std::complex<T> *arr) {
+		//large copies stay off the stack
+		std::complex<T> local[size <= FFT_CODELET_MAX ? size : 1];
+		static thread_local std::complex<T>
+			shared[size <= FFT_CODELET_MAX ? 1 : size];
+		std::complex<T> *tmp = size <= FFT_CODELET_MAX ? local : shared;
+		//the transform is linear, the scaling rides on the copy
+		if (normalize) {
+			const T scale = T(1) / size;
+			for (size_t i = 0; i < size; i++) {
+				tmp[i] = arr[i] * scale;
+			}
+		}
+		else {
+			for (size_t i = 0; i < size; i++) {
+				tmp[i] = arr[i];
+			}
+		}
+		FftCodelet<T, size, inverse>::apply(tmp, 1, arr);
+		return true;
+	}
+};
+
+#endif
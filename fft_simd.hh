@@ -0,0 +1,407 @@
+#ifndef __FFT_SIMD_HH__
+#define __FFT_SIMD_HH__
+
+#include <cstring>
+#include <vector>
+#include <complex>
+
+#include "fft.hh"
+
+/*
+ * SIMD FFT over a split-complex (separate real and imaginary arrays)
+ * buffer. With the two parts apart every butterfly is a handful of
+ * plain vector multiplies and adds, with no shuffles and no NaN checks
+ * of std::complex multiplication.
+ *
+ * The butterfly passes are written once against GCC vector extensions
+ * and compiled for SSE2, AVX2 and AVX-512 through target attributes,
+ * the widest one the CPU supports is picked at runtime.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define FFT_SIMD_X86
+#endif
+
+enum FftSimdLevel {
+	FFT_SIMD_NONE,
+	FFT_SIMD_SSE2,
+	FFT_SIMD_AVX2,
+	FFT_SIMD_AVX512,
+};
+
+static inline FftSimdLevel fft_simd_level() {
+#ifdef FFT_SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		return FFT_SIMD_AVX512;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		return FFT_SIMD_AVX2;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		return FFT_SIMD_SSE2;
+	}
+#endif
+	return FFT_SIMD_NONE;
+}
+
+template <class T>
+class SplitComplex {
+protected:
+	std::vector<T> mReal;
+	std::vector<T> mImag;
+
+public:
+	SplitComplex(size_t size = 0) : mReal(size), mImag(size) {}
+
+	inline size_t size() const {
+		return mReal.size();
+	}
+
+	void resize(size_t size) {
+		mReal.resize(size);
+		mImag.resize(size);
+	}
+
+	inline T *real() {
+		return mReal.data();
+	}
+
+	inline T *imag() {
+		return mImag.data();
+	}
+
+	inline const T *real() const {
+		return mReal.data();
+	}
+
+	inline const T *imag() const {
+		return mImag.data();
+	}
+
+	//from interleaved std::complex layout
+	void load(const std::complex<T> *in) {
+		for (size_t i = 0; i < size(); i++) {
+			mReal[i] = in[i].real();
+			mImag[i] = in[i].imag();
+		}
+	}
+
+	//to interleaved std::complex layout
+	void store(std::complex<T> *out) const {
+		for (size_t i = 0; i < size(); i++) {
+			out[i] = std::complex<T>(mReal[i], mImag[i]);
+		}
+	}
+};
+
+#define FFT_SIMD_INLINE inline __attribute__((always_inline))
+
+template <class T, size_t bytes>
+struct SimdVector {
+	typedef T type __attribute__((vector_size(bytes)));
+};
+
+template <class V, class T>
+static FFT_SIMD_INLINE void simd_load(V &v, const T *p) {
+	memcpy(&v, p, sizeof(V));
+}
+
+template <class V, class T>
+static FFT_SIMD_INLINE void simd_store(T *p, const V &v) {
+	memcpy(p, &v, sizeof(V));
+}
+
+/*
+ * Radix-4 decimation in time pass over bit-reversed split-complex data,
+ * same arithmetic as FftPlan::radix4_butterflies. V is a vector of T
+ * or T itself, h must be a multiple of the vector width.
+ * tw holds h real and h imaginary parts of W^k, W^2k and W^3k.
+ */
+template <class V, class T>
+static FFT_SIMD_INLINE void simd_radix4_pass(T *re, T *im, size_t size,
+	size_t h, const T *tw, T dir)
+{
+	const size_t width = sizeof(V) / sizeof(T);
+	const T *w1r = tw;
+	const T *w1i = tw + h;
+	const T *w2r = tw + 2 * h;
+	const T *w2i = tw + 3 * h;
+	const T *w3r = tw + 4 * h;
+	const T *w3i = tw + 5 * h;
+
+	for (size_t start = 0; start < size; start += 4 * h) {
+		T *r0 = re + start, *r1 = r0 + h, *r2 = r1 + h, *r3 = r2 + h;
+		T *i0 = im + start, *i1 = i0 + h, *i2 = i1 + h, *i3 = i2 + h;
+
+		for (size_t k = 0; k < h; k += width) {
+			V s0r, s0i, x1r, x1i, x2r, x2i, x3r, x3i;
+			V wr, wi;
+			simd_load(s0r, r0 + k);
+			simd_load(s0i, i0 + k);
+			simd_load(x1r, r1 + k);
+			simd_load(x1i, i1 + k);
+			simd_load(x2r, r2 + k);
+			simd_load(x2i, i2 + k);
+			simd_load(x3r, r3 + k);
+			simd_load(x3i, i3 + k);
+
+			simd_load(wr, w1r + k);
+			simd_load(wi, w1i + k);
+			V t1r = x2r * wr - x2i * wi;
+			V t1i = x2r * wi + x2i * wr;
+
+			simd_load(wr, w2r + k);
+			simd_load(wi, w2i + k);
+			V t2r = x1r * wr - x1i * wi;
+			V t2i = x1r * wi + x1i * wr;
+
+			simd_load(wr, w3r + k);
+			simd_load(wi, w3i + k);
+			V t3r = x3r * wr - x3i * wi;
+			V t3i = x3r * wi + x3i * wr;
+
+			V ar = s0r + t2r, ai = s0i + t2i;
+			V br = s0r - t2r, bi = s0i - t2i;
+			V cr = t1r + t3r, ci = t1i + t3i;
+			//(t1 - t3) rotated by W_4 = dir * i
+			V dr = (t3i - t1i) * dir;
+			V di = (t1r - t3r) * dir;
+
+			V o0r = ar + cr, o0i = ai + ci;
+			V o1r = br + dr, o1i = bi + di;
+			V o2r = ar - cr, o2i = ai - ci;
+			V o3r = br - dr, o3i = bi - di;
+			simd_store(r0 + k, o0r);
+			simd_store(i0 + k, o0i);
+			simd_store(r1 + k, o1r);
+			simd_store(i1 + k, o1i);
+			simd_store(r2 + k, o2r);
+			simd_store(i2 + k, o2i);
+			simd_store(r3 + k, o3r);
+			simd_store(i3 + k, o3i);
+		}
+	}
+}
+
+/*
+ * All butterfly passes of a power-of-two transform on bit-reversed
+ * split-complex data. Passes narrower than the vector run on scalars.
+ */
+template <class V, class T>
+static FFT_SIMD_INLINE void simd_fft_passes(T *re, T *im, size_t size,
+	const T *tw, bool odd_power, bool inverse, bool normalize)
+{
+	const size_t width = sizeof(V) / sizeof(T);
+	T dir = inverse ? 1 : -1;
+	size_t h = 1;
+
+	if (odd_power) {
+		for (size_t i = 0; i < size; i += 2) {
+			T ar = re[i], ai = im[i];
+			re[i] = ar + re[i + 1];
+			im[i] = ai + im[i + 1];
+			re[i + 1] = ar - re[i + 1];
+			im[i + 1] = ai - im[i + 1];
+		}
+		h = 2;
+	}
+
+	for (; h < size; tw += 6 * h, h *= 4) {
+		if (h < width) {
+			simd_radix4_pass<T, T>(re, im, size, h, tw, dir);
+		}
+		else {
+			simd_radix4_pass<V, T>(re, im, size, h, tw, dir);
+		}
+	}
+
+	if (normalize) {
+		T scale = static_cast<T>(1) / static_cast<T>(size);
+		for (size_t i = 0; i < size; i++) {
+			re[i] *= scale;
+			im[i] *= scale;
+		}
+	}
+}
+
+template <class T>
+static void simd_fft_passes_scalar(T *re, T *im, size_t size,
+	const T *tw, bool odd_power, bool inverse, bool normalize)
+{
+	simd_fft_passes<T, T>(re, im, size, tw, odd_power, inverse, normalize);
+}
+
+#ifdef FFT_SIMD_X86
+template <class T>
+__attribute__((target("sse2")))
+static void simd_fft_passes_sse2(T *re, T *im, size_t size,
+	const T *tw, bool odd_power, bool inverse, bool normalize)
+{
+	simd_fft_passes<typename SimdVector<T, 16>::type, T>(
+		re, im, size, tw, odd_power, inverse, normalize);
+}
+
+template <class T>
+__attribute__((target("avx2,fma")))
+static void simd_fft_passes_avx2(T *re, T *im, size_t size,
+	const T *tw, bool odd_power, bool inverse, bool normalize)
+{
+	simd_fft_passes<typename SimdVector<T, 32>::type, T>(
+		re, im, size, tw, odd_power, inverse, normalize);
+}
+
+template <class T>
+__attribute__((target("avx512f")))
+static void simd_fft_passes_avx512(T *re, T *im, size_t size,
+	const T *tw, bool odd_power, bool inverse, bool normalize)
+{
+	simd_fft_passes<typename SimdVector<T, 64>::type, T>(
+		re, im, size, tw, odd_power, inverse, normalize);
+}
+#endif
+
+/*
+ * SimdFftPlan runs power-of-two transforms of float or double on the
+ * split-complex layout. execute() on std::complex data converts at the
+ * boundary, the bit-reversal is done while deinterleaving.
+ * Other sizes fall back to FftPlan.
+ * Like FftPlan it keeps scratch buffers, so use one plan per thread.
+ */
+template <class T>
+class SimdFftPlan {
+protected:
+	typedef void (*PassesFunc)(T *re, T *im, size_t size,
+		const T *tw, bool odd_power, bool inverse, bool normalize);
+
+	size_t mSize;
+	bool mInverse;
+	bool mNormalize;
+	bool mPowerOfTwo;
+	bool mOddPower;
+	FftSimdLevel mLevel;
+	PassesFunc mPasses;
+
+	//per radix-4 pass: real and imaginary W^k, W^2k, W^3k for k < h
+	std::vector<T> mTwiddles;
+	std::vector<size_t> mBitrev;
+	SplitComplex<T> mBuffer;
+	FftPlan<T> mFallback;
+
+	void select(FftSimdLevel level) {
+		mLevel = FFT_SIMD_NONE;
+		mPasses = simd_fft_passes_scalar<T>;
+#ifdef FFT_SIMD_X86
+		if (level >= FFT_SIMD_AVX512) {
+			mLevel = FFT_SIMD_AVX512;
+			mPasses = simd_fft_passes_avx512<T>;
+		}
+		else if (level >= FFT_SIMD_AVX2) {
+			mLevel = FFT_SIMD_AVX2;
+			mPasses = simd_fft_passes_avx2<T>;
+		}
+		else if (level >= FFT_SIMD_SSE2) {
+			mLevel = FFT_SIMD_SSE2;
+			mPasses = simd_fft_passes_sse2<T>;
+		}
+#endif
+	}
+
+public:
+	SimdFftPlan(size_t size, bool inverse,
+		FftSimdLevel level = fft_simd_level(),
+		FftNormalization normalization = FFT_NORMALIZE_INVERSE)
+		: mSize(size), mInverse(inverse),
+		mNormalize(inverse && normalization == FFT_NORMALIZE_INVERSE),
+		mPowerOfTwo(size && size == next_power_of_two(size)),
+		mOddPower(false), mBuffer(size),
+		mFallback(mPowerOfTwo ? 0 : size, inverse, FFT_AUTO, normalization)
+	{
+		select(level);
+		if (!mPowerOfTwo) {
+			return;
+		}
+
+		for (size_t s = 1; s < size; s <<= 1) {
+			mOddPower = !mOddPower;
+		}
+
+		long double dir = inverse ? 1 : -1;
+		for (size_t h = mOddPower ? 2 : 1; h < size; h *= 4) {
+			size_t offset = mTwiddles.size();
+			mTwiddles.resize(offset + 6 * h);
+			long double angle = dir * M_PI / (2 * h);
+			for (size_t t = 1; t <= 3; t++) {
+				T *wr = mTwiddles.data() + offset + 2 * (t - 1) * h;
+				T *wi = wr + h;
+				for (size_t k = 0; k < h; k++) {
+					std::complex<long double> w =
+						std::polar<long double>(1, angle * k * t);
+					wr[k] = static_cast<T>(w.real());
+					wi[k] = static_cast<T>(w.imag());
+				}
+			}
+		}
+
+		mBitrev.resize(size);
+		for (size_t i = 0, j = 0; i < size; i++) {
+			mBitrev[i] = j;
+			size_t k = size >> 1;
+			while (k && k <= j) {
+				j -= k;
+				k >>= 1;
+			}
+			j += k;
+		}
+	}
+
+	inline size_t size() const {
+		return mSize;
+	}
+
+	inline FftSimdLevel level() const {
+		return mLevel;
+	}
+
+	void execute(SplitComplex<T> &data) {
+		if (!mPowerOfTwo) {
+			std::vector<std::complex<T> > tmp(mSize);
+			data.store(tmp.data());
+			mFallback.execute(tmp.data());
+			data.load(tmp.data());
+			return;
+		}
+
+		T *re = data.real();
+		T *im = data.imag();
+		for (size_t i = 0; i < mSize; i++) {
+			size_t j = mBitrev[i];
+			if (i < j) {
+				std::swap(re[i], re[j]);
+				std::swap(im[i], im[j]);
+			}
+		}
+		mPasses(re, im, mSize, mTwiddles.data(), mOddPower, mInverse,
+			mNormalize);
+	}
+
+	void execute(std::complex<T> *arr) {
+		if (!mPowerOfTwo) {
+			mFallback.execute(arr);
+			return;
+		}
+
+		T *re = mBuffer.real();
+		T *im = mBuffer.imag();
+		for (size_t i = 0; i < mSize; i++) {
+			size_t j = mBitrev[i];
+			re[j] = arr[i].real();
+			im[j] = arr[i].imag();
+		}
+		mPasses(re, im, mSize, mTwiddles.data(), mOddPower, mInverse,
+			mNormalize);
+		mBuffer.store(arr);
+	}
+};
+
+#endif
@@ -0,0 +1,385 @@
+#ifndef __FFT_TUNER_HH__
+#define __FFT_TUNER_HH__
+
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "fft.hh"
+#include "fft_simd.hh"
+
+#ifdef FFT_SIMD_X86
+	#include <cpuid.h>
+#endif
+
+/*
+ * FFT autotuner. The first TunedFftPlan of a size, sample type and
+ * direction times every variant that applies (the FftPlan algorithms
+ * and the SIMD plan) and remembers the fastest one. The choices live
+ * in a per-process table and optionally in a wisdom file so that the
+ * next start skips the measurement. A wisdom file is only used on the
+ * CPU it was written on, other machines measure again.
+ *
+ * The wisdom file is picked with fft_tuner().set_wisdom_file() or the
+ * FFT_WISDOM environment variable.
+ */
+
+//a variant is an FftAlgorithm or the SIMD plan
+#define FFT_TUNED_SIMD (-1)
+
+//minimum time a variant runs for while being measured
+#ifndef FFT_TUNER_MIN_TIME_US
+	#define FFT_TUNER_MIN_TIME_US 2000
+#endif
+
+template <class T>
+struct FftTunerType;
+
+template <>
+struct FftTunerType<float> {
+	static const char *name() {
+		return "float";
+	}
+	enum { SIMD = 1 };
+};
+
+template <>
+struct FftTunerType<double> {
+	static const char *name() {
+		return "double";
+	}
+	enum { SIMD = 1 };
+};
+
+template <>
+struct FftTunerType<long double> {
+	static const char *name() {
+		return "long-double";
+	}
+	enum { SIMD = 0 };
+};
+
+static inline const char *fft_variant_name(int variant) {
+	switch (variant) {
+	case FFT_TUNED_SIMD:
+		return "simd";
+	case FFT_RADIX2:
+		return "radix2";
+	case FFT_RADIX4:
+		return "radix4";
+	case FFT_SPLIT_RADIX:
+		return "split-radix";
+	case FFT_STOCKHAM:
+		return "stockham";
+	case FFT_BLUESTEIN:
+		return "bluestein";
+	case FFT_FOUR_STEP:
+		return "four-step";
+	default:
+		return "auto";
+	}
+}
+
+static inline int fft_variant_from_name(const std::string &name) {
+	const int variants[] = {
+		FFT_TUNED_SIMD, FFT_RADIX2, FFT_RADIX4, FFT_SPLIT_RADIX,
+		FFT_STOCKHAM, FFT_BLUESTEIN, FFT_FOUR_STEP,
+	};
+	for (size_t i = 0; i < sizeof(variants) / sizeof(variants[0]); i++) {
+		if (name == fft_variant_name(variants[i])) {
+			return variants[i];
+		}
+	}
+	return FFT_AUTO;
+}
+
+//identifies the machine a wisdom file was measured on
+static inline std::string fft_cpu_signature() {
+	std::ostringstream sig;
+#ifdef FFT_SIMD_X86
+	unsigned int regs[12];
+	if (__get_cpuid(0x80000002, regs, regs + 1, regs + 2, regs + 3) &&
+		__get_cpuid(0x80000003, regs + 4, regs + 5, regs + 6, regs + 7) &&
+		__get_cpuid(0x80000004, regs + 8, regs + 9, regs + 10, regs + 11))
+	{
+		char brand[sizeof(regs) + 1];
+		memcpy(brand, regs, sizeof(regs));
+		brand[sizeof(regs)] = 0;
+		//runs of spaces become one '_', leading and trailing ones go
+		bool space = false;
+		for (const char *c = brand; *c; c++) {
+			if (*c == ' ') {
+				space = true;
+				continue;
+			}
+			if (space && sig.tellp() > 0) {
+				sig << '_';
+			}
+			space = false;
+			sig << *c;
+		}
+	}
+#endif
+	if (sig.tellp() <= 0) {
+		sig << "generic";
+	}
+	sig << "/simd" << fft_simd_level() << "/threads" << fft_max_threads();
+	return sig.str();
+}
+
+class FftTuner {
+protected:
+	//(type, size), inverse
+	typedef std::pair<std::pair<std::string, size_t>, bool> Key;
+
+	std::mutex mLock;
+	std::map<Key, int> mChoices;
+	std::string mWisdomFile;
+
+	bool save_locked(const std::string &path) const {
+		std::ofstream out(path.c_str());
+		if (!out) {
+			return false;
+		}
+		out << "fft-wisdom " << fft_cpu_signature() << std::endl;
+		for (std::map<Key, int>::const_iterator it = mChoices.begin();
+			it != mChoices.end(); ++it)
+		{
+			out << it->first.first.first << " " << it->first.first.second
+				<< " " << (it->first.second ? "inverse" : "forward") << " "
+				<< fft_variant_name(it->second) << std::endl;
+		}
+		return out.good();
+	}
+
+	bool load_locked(const std::string &path) {
+		std::ifstream in(path.c_str());
+		std::string magic, cpu;
+		if (!(in >> magic >> cpu) || magic != "fft-wisdom" ||
+			cpu != fft_cpu_signature())
+		{
+			return false;
+		}
+
+		std::string type, direction, name;
+		size_t size;
+		while (in >> type >> size >> direction >> name) {
+			int variant = fft_variant_from_name(name);
+			if (variant != FFT_AUTO) {
+				Key key(std::make_pair(type, size), direction == "inverse");
+				mChoices[key] = variant;
+			}
+		}
+		return true;
+	}
+
+public:
+	FftTuner() {
+		const char *path = getenv("FFT_WISDOM");
+		if (path && *path) {
+			set_wisdom_file(path);
+		}
+	}
+
+	//FFT_AUTO when the shape has not been measured
+	int lookup(const char *type, size_t size, bool inverse) {
+		std::lock_guard<std::mutex> guard(mLock);
+		std::map<Key, int>::const_iterator it =
+			mChoices.find(Key(std::make_pair(type, size), inverse));
+		return it == mChoices.end() ? FFT_AUTO : it->second;
+	}
+
+	//remembers a choice, written through to the wisdom file if there is one
+	void store(const char *type, size_t size, bool inverse, int variant) {
+		std::lock_guard<std::mutex> guard(mLock);
+		mChoices[Key(std::make_pair(type, size), inverse)] = variant;
+		if (!mWisdomFile.empty()) {
+			save_locked(mWisdomFile);
+		}
+	}
+
+	//merges the choices of a wisdom file written on this CPU
+	bool load(const std::string &path) {
+		std::lock_guard<std::mutex> guard(mLock);
+		return load_locked(path);
+	}
+
+	bool save(const std::string &path) {
+		std::lock_guard<std::mutex> guard(mLock);
+		return save_locked(path);
+	}
+
+	//loads the file now and saves every new choice to it
+	bool set_wisdom_file(const std::string &path) {
+		std::lock_guard<std::mutex> guard(mLock);
+		mWisdomFile = path;
+		return load_locked(path);
+	}
+
+	void forget() {
+		std::lock_guard<std::mutex> guard(mLock);
+		mChoices.clear();
+	}
+};
+
+static inline FftTuner &fft_tuner() {
+	static FftTuner tuner;
+	return tuner;
+}
+
+//the SIMD plan only exists for float and double
+template <class T, bool simd = FftTunerType<T>::SIMD>
+struct FftTunerSimd {
+	typedef FftPlan<T> Plan;
+	static Plan *create(size_t size, bool inverse, FftNormalization norm) {
+		return new Plan(size, inverse, FFT_AUTO, norm);
+	}
+};
+
+template <class T>
+struct FftTunerSimd<T, true> {
+	typedef SimdFftPlan<T> Plan;
+	static Plan *create(size_t size, bool inverse, FftNormalization norm) {
+		return new Plan(size, inverse, fft_simd_level(), norm);
+	}
+};
+
+/*
+ * FFT plan running the fastest variant for its size on this machine,
+ * measured on first use of the shape unless the tuner already knows it.
+ */
+template <class T>
+class TunedFftPlan {
+protected:
+	typedef typename FftTunerSimd<T>::Plan SimdPlan;
+
+	int mVariant;
+	std::unique_ptr<FftPlan<T> > mPlan;
+	std::unique_ptr<SimdPlan> mSimdPlan;
+
+	void create(size_t size, bool inverse, FftNormalization normalization) {
+		mPlan.reset();
+		mSimdPlan.reset();
+		if (mVariant == FFT_TUNED_SIMD) {
+			mSimdPlan.reset(FftTunerSimd<T>::create(size, inverse,
+				normalization));
+		}
+		else {
+			mPlan.reset(new FftPlan<T>(size, inverse,
+				(FftAlgorithm)mVariant, normalization));
+		}
+	}
+
+	//microseconds per transform, the best of a few rounds
+	double measure(std::complex<T> *data) {
+		typedef std::chrono::steady_clock Clock;
+		double best = 0;
+
+		execute(data);
+		for (int round = 0; round < 3; round++) {
+			size_t runs = 0;
+			Clock::time_point start = Clock::now();
+			double elapsed;
+			do {
+				execute(data);
+				runs++;
+				elapsed = std::chrono::duration<double, std::micro>(
+					Clock::now() - start).count();
+			} while (elapsed < FFT_TUNER_MIN_TIME_US / 3);
+
+			double per_run = elapsed / runs;
+			if (!round || per_run < best) {
+				best = per_run;
+			}
+		}
+		return best;
+	}
+
+	int tune(size_t size, bool inverse) {
+		std::vector<int> candidates;
+		bool power_of_two = size == next_power_of_two(size);
+		if (power_of_two) {
+			candidates.push_back(FFT_RADIX2);
+			candidates.push_back(FFT_RADIX4);
+			candidates.push_back(FFT_SPLIT_RADIX);
+			if (FftTunerType<T>::SIMD) {
+				candidates.push_back(FFT_TUNED_SIMD);
+			}
+		}
+		candidates.push_back(FFT_STOCKHAM);
+		candidates.push_back(FFT_FOUR_STEP);
+
+		std::vector<std::complex<T> > data(size);
+		for (size_t i = 0; i < size; i++) {
+			data[i] = std::complex<T>(i % 7, i % 3);
+		}
+
+		int best = FFT_AUTO;
+		double best_time = 0;
+		std::vector<int> seen;
+		for (size_t i = 0; i < candidates.size(); i++) {
+			mVariant = candidates[i];
+			create(size, inverse, FFT_NORMALIZE_INVERSE);
+			//sizes without such a plan fall back to another algorithm
+			if (mPlan) {
+				mVariant = mPlan->algorithm();
+			}
+			if (std::find(seen.begin(), seen.end(), mVariant) != seen.end()) {
+				continue;
+			}
+			seen.push_back(mVariant);
+
+			double time = measure(data.data());
+			if (best == FFT_AUTO || time < best_time) {
+				best = mVariant;
+				best_time = time;
+			}
+		}
+		return best;
+	}
+
+public:
+	TunedFftPlan(size_t size, bool inverse,
+		FftNormalization normalization = FFT_NORMALIZE_INVERSE)
+		: mVariant(FFT_AUTO)
+	{
+		const char *type = FftTunerType<T>::name();
+		FftTuner &tuner = fft_tuner();
+
+		if (size >= 2) {
+			mVariant = tuner.lookup(type, size, inverse);
+			if (mVariant == FFT_AUTO) {
+				mVariant = tune(size, inverse);
+				tuner.store(type, size, inverse, mVariant);
+			}
+		}
+		create(size, inverse, normalization);
+	}
+
+	inline int variant() const {
+		return mVariant;
+	}
+
+	inline const char *variant_name() const {
+		return fft_variant_name(mVariant);
+	}
+
+	//in place transform
+	void execute(std::complex<T> *arr) {
+		if (mSimdPlan) {
+			mSimdPlan->execute(arr);
+		}
+		else {
+			mPlan->execute(arr);
+		}
+	}
+};
+
+#endif
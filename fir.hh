@@ -0,0 +1,338 @@
+#ifndef __FIR_HH__
+#define __FIR_HH__
+
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+#include "fft_simd.hh"
+
+/*
+ * Direct form FIR filter for short and medium filters (8 to 512 taps)
+ * where an FFT does not pay off yet.
+ *
+ * The filter keeps the last taps - 1 input samples in front of the
+ * block being filtered, so out[n] = sum of c[k] * x[n + k] over the
+ * padded buffer x with the coefficients c stored reversed: there are
+ * no bounds checks and every output reads forward. The kernel computes
+ * a vector of consecutive outputs at a time, each coefficient is
+ * broadcast and multiplied with the input at that lag, so there are no
+ * horizontal sums and short filters vectorize as well as long ones.
+ *
+ * Like the SIMD FFT it is written against GCC vector extensions and
+ * compiled for SSE2, AVX2 and AVX-512, picked at runtime, and for the
+ * native 16 byte vectors (NEON) elsewhere. float and double accumulate
+ * in their own precision, int16_t samples with Q15 coefficients
+ * accumulate in 32 bits and are rounded and saturated on output; the
+ * sum of the absolute coefficients must stay below 2.0 for the
+ * accumulator not to wrap.
+ */
+
+//input samples filtered per pass over the history buffer
+#ifndef FIR_BLOCK
+	#define FIR_BLOCK 1024
+#endif
+//integer filters this long use fir_kernel_dot()
+#ifndef FIR_DOT_MIN_TAPS
+	#define FIR_DOT_MIN_TAPS 32
+#endif
+//alignment of the coefficient table in bytes
+#define FIR_ALIGN 64
+
+template <class T>
+struct FirTraits;
+
+template <>
+struct FirTraits<float> {
+	typedef float Acc;
+	enum { DOT = 0 };
+	static inline float output(float x) {
+		return x;
+	}
+};
+
+template <>
+struct FirTraits<double> {
+	typedef double Acc;
+	enum { DOT = 0 };
+	static inline double output(double x) {
+		return x;
+	}
+};
+
+template <>
+struct FirTraits<int16_t> {
+	typedef int32_t Acc;
+	enum { FRAC_BITS = 15, DOT = 1 };
+	static inline int16_t output(int32_t x) {
+		x = (x + (1 << (FRAC_BITS - 1))) >> FRAC_BITS;
+		return x > 32767 ? 32767 : x < -32768 ? -32768 : x;
+	}
+};
+
+//v = a vector of accumulators from the samples at p
+template <class V, class T, class A,
+	bool scalar = (sizeof(V) == sizeof(A)), bool widen = (sizeof(T) < sizeof(A))>
+struct FirLoad {
+	static FFT_SIMD_INLINE void load(V &v, const T *p) {
+		memcpy(&v, p, sizeof(V));
+	}
+};
+
+template <class V, class T, class A, bool widen>
+struct FirLoad<V, T, A, true, widen> {
+	static FFT_SIMD_INLINE void load(V &v, const T *p) {
+		v = *p;
+	}
+};
+
+template <class V, class T, class A>
+struct FirLoad<V, T, A, false, true> {
+	typedef T Narrow __attribute__((vector_size(sizeof(V) /
+		sizeof(A) * sizeof(T))));
+	static FFT_SIMD_INLINE void load(V &v, const T *p) {
+		Narrow n;
+		memcpy(&n, p, sizeof(n));
+		v = __builtin_convertvector(n, V);
+	}
+};
+
+template <class V, class T>
+static FFT_SIMD_INLINE void fir_store(T *out, const V &v) {
+	typedef typename FirTraits<T>::Acc A;
+	const size_t width = sizeof(V) / sizeof(A);
+	A acc[width];
+	memcpy(acc, &v, sizeof(V));
+	for (size_t i = 0; i < width; i++) {
+		out[i] = FirTraits<T>::output(acc[i]);
+	}
+}
+
+/*
+ * out[n] = sum of c[k] * x[n + k] for n < count and k < taps.
+ * Four vectors of outputs share every coefficient broadcast, the rest
+ * go one vector and then one sample at a time.
+ */
+template <class V, class T>
+static FFT_SIMD_INLINE void fir_kernel_broadcast(const T *x, const T *c,
+	size_t taps, T *out, size_t count)
+{
+	typedef typename FirTraits<T>::Acc A;
+	typedef FirLoad<V, T, A> Load;
+	const size_t width = sizeof(V) / sizeof(A);
+	const V zero = V() * 0;
+	size_t n = 0;
+
+	for (; n + 4 * width <= count; n += 4 * width) {
+		V a0 = zero, a1 = zero, a2 = zero, a3 = zero;
+		const T *p = x + n;
+		for (size_t k = 0; k < taps; k++) {
+			V ck = zero + static_cast<A>(c[k]);
+			V x0, x1, x2, x3;
+			Load::load(x0, p + k);
+			Load::load(x1, p + k + width);
+			Load::load(x2, p + k + 2 * width);
+			Load::load(x3, p + k + 3 * width);
+			a0 += ck * x0;
+			a1 += ck * x1;
+			a2 += ck * x2;
+			a3 += ck * x3;
+		}
+		fir_store(out + n, a0);
+		fir_store(out + n + width, a1);
+		fir_store(out + n + 2 * width, a2);
+		fir_store(out + n + 3 * width, a3);
+	}
+
+	for (; n + width <= count; n += width) {
+		V a0 = zero;
+		for (size_t k = 0; k < taps; k++) {
+			V x0;
+			Load::load(x0, x + n + k);
+			a0 += (zero + static_cast<A>(c[k])) * x0;
+		}
+		fir_store(out + n, a0);
+	}
+
+	for (; n < count; n++) {
+		A a0 = 0;
+		for (size_t k = 0; k < taps; k++) {
+			a0 += static_cast<A>(c[k]) * static_cast<A>(x[n + k]);
+		}
+		out[n] = FirTraits<T>::output(a0);
+	}
+}
+
+/*
+ * out[n] as one dot product of the taps per output, for integer
+ * samples. The compiler turns the widening multiply-add into pmaddwd
+ * on x86 (two taps per 32-bit lane) and smlal on ARM, which beats
+ * widening every sample first once the filter is long enough for the
+ * horizontal sum at the end not to matter.
+ */
+template <class T>
+static FFT_SIMD_INLINE void fir_kernel_dot(const T *x, const T *c,
+	size_t taps, T *out, size_t count)
+{
+	typedef typename FirTraits<T>::Acc A;
+	for (size_t n = 0; n < count; n++) {
+		const T *p = x + n;
+		A acc = 0;
+		for (size_t k = 0; k < taps; k++) {
+			acc += static_cast<A>(p[k]) * static_cast<A>(c[k]);
+		}
+		out[n] = FirTraits<T>::output(acc);
+	}
+}
+
+template <class V, class T>
+static FFT_SIMD_INLINE void fir_kernel(const T *x, const T *c,
+	size_t taps, T *out, size_t count)
+{
+	if (FirTraits<T>::DOT && taps >= FIR_DOT_MIN_TAPS) {
+		fir_kernel_dot(x, c, taps, out, count);
+	}
+	else {
+		fir_kernel_broadcast<V>(x, c, taps, out, count);
+	}
+}
+
+template <class T>
+static void fir_kernel_scalar(const T *x, const T *c, size_t taps,
+	T *out, size_t count)
+{
+	fir_kernel_broadcast<typename FirTraits<T>::Acc>(x, c, taps, out, count);
+}
+
+#ifdef FFT_SIMD_X86
+template <class T>
+__attribute__((target("sse2")))
+static void fir_kernel_sse2(const T *x, const T *c, size_t taps,
+	T *out, size_t count)
+{
+	fir_kernel<typename SimdVector<typename FirTraits<T>::Acc, 16>::type>(
+		x, c, taps, out, count);
+}
+
+template <class T>
+__attribute__((target("avx2,fma")))
+static void fir_kernel_avx2(const T *x, const T *c, size_t taps,
+	T *out, size_t count)
+{
+	fir_kernel<typename SimdVector<typename FirTraits<T>::Acc, 32>::type>(
+		x, c, taps, out, count);
+}
+
+template <class T>
+__attribute__((target("avx512f")))
+static void fir_kernel_avx512(const T *x, const T *c, size_t taps,
+	T *out, size_t count)
+{
+	fir_kernel<typename SimdVector<typename FirTraits<T>::Acc, 64>::type>(
+		x, c, taps, out, count);
+}
+#elif defined(__GNUC__)
+//the native 16 byte vectors, NEON on ARM
+template <class T>
+static void fir_kernel_vector(const T *x, const T *c, size_t taps,
+	T *out, size_t count)
+{
+	fir_kernel<typename SimdVector<typename FirTraits<T>::Acc, 16>::type>(
+		x, c, taps, out, count);
+}
+#endif
+
+/*
+ * Streaming FIR filter over float, double or int16_t samples, int16_t
+ * coefficients are Q15. The history and the coefficient table are
+ * allocated once, process() takes blocks of any length and carries
+ * the state from one to the next. One filter per thread.
+ */
+template <class T>
+class FirFilter {
+protected:
+	typedef void (*KernelFunc)(const T *x, const T *c, size_t taps,
+		T *out, size_t count);
+
+	size_t mTaps;
+	FftSimdLevel mLevel;
+	KernelFunc mKernel;
+
+	//reversed coefficients at mCoeffs, aligned to FIR_ALIGN
+	std::vector<T> mCoeffStorage;
+	T *mCoeffs;
+	//taps - 1 past samples, then up to FIR_BLOCK new ones
+	std::vector<T> mHistory;
+
+	void select(FftSimdLevel level) {
+		mLevel = FFT_SIMD_NONE;
+		mKernel = fir_kernel_scalar<T>;
+#ifdef FFT_SIMD_X86
+		if (level >= FFT_SIMD_AVX512) {
+			mLevel = FFT_SIMD_AVX512;
+			mKernel = fir_kernel_avx512<T>;
+		}
+		else if (level >= FFT_SIMD_AVX2) {
+			mLevel = FFT_SIMD_AVX2;
+			mKernel = fir_kernel_avx2<T>;
+		}
+		else if (level >= FFT_SIMD_SSE2) {
+			mLevel = FFT_SIMD_SSE2;
+			mKernel = fir_kernel_sse2<T>;
+		}
+#elif defined(__GNUC__)
+		if (level != FFT_SIMD_NONE) {
+			mKernel = fir_kernel_vector<T>;
+		}
+#endif
+	}
+
+public:
+	FirFilter(const T *coeffs, size_t taps,
+		FftSimdLevel level = fft_simd_level())
+		: mTaps(taps ? taps : 1),
+		mCoeffStorage(mTaps + FIR_ALIGN / sizeof(T), T(0)),
+		mHistory(mTaps - 1 + FIR_BLOCK, T(0))
+	{
+		select(level);
+
+		size_t misalign = reinterpret_cast<uintptr_t>(
+			mCoeffStorage.data()) % FIR_ALIGN;
+		mCoeffs = mCoeffStorage.data() +
+			(misalign ? (FIR_ALIGN - misalign) / sizeof(T) : 0);
+		for (size_t k = 0; k < taps; k++) {
+			mCoeffs[mTaps - 1 - k] = coeffs[k];
+		}
+	}
+
+	inline size_t taps() const {
+		return mTaps;
+	}
+
+	inline FftSimdLevel level() const {
+		return mLevel;
+	}
+
+	//out[n] = sum of coeffs[k] * in[n - k], in and out may be the same
+	void process(const T *in, T *out, size_t count) {
+		T *x = mHistory.data();
+		size_t past = mTaps - 1;
+		while (count) {
+			size_t n = std::min<size_t>(count, FIR_BLOCK);
+			std::copy(in, in + n, x + past);
+			mKernel(x, mCoeffs, mTaps, out, n);
+			//the newest taps - 1 samples are the next block's past
+			memmove(x, x + n, past * sizeof(T));
+			in += n;
+			out += n;
+			count -= n;
+		}
+	}
+
+	void reset() {
+		std::fill(mHistory.begin(), mHistory.end(), T(0));
+	}
+};
+
+#endif
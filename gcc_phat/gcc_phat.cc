@@ -0,0 +1,84 @@
+#include <sndfile.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <map>
+#include <vector>
+
+#include "../correlation.hh"
+
+/*
+ * Prints the delay between every pair of channels of a multichannel
+ * recording, block by block, and the most common delay per pair over
+ * the file, which is what lines the channels up.
+ * usage: gcc_phat in.wav [block frames] [max delay in ms]
+ */
+int main(int argc, char **argv)
+{
+	if (argc < 2 || argc > 4) {
+		printf("usage: %s in.wav [block frames] [max delay ms]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	SF_INFO info = {};
+	SNDFILE *in = sf_open(argv[1], SFM_READ, &info);
+	if (!in) {
+		fprintf(stderr, "%s\n", sf_strerror(0));
+		return EXIT_FAILURE;
+	}
+	if (info.channels < 2) {
+		fprintf(stderr, "%s has a single channel\n", argv[1]);
+		sf_close(in);
+		return EXIT_FAILURE;
+	}
+
+	size_t block = argc > 2 ? atoi(argv[2]) : 8192;
+	size_t max_delay = argc > 3 ?
+		(size_t)(atof(argv[3]) * info.samplerate / 1000) : 0;
+	GccPhat<float> phat(info.channels, block, max_delay);
+
+	printf("rate %d, frames %d channels %d, %d pairs, max delay %d\n",
+		info.samplerate, (int)info.frames, info.channels,
+		(int)phat.pairs(), (int)phat.max_delay());
+
+	std::vector<float> frames(block * info.channels);
+	std::vector<ChannelDelay> delays;
+	//votes for each whole sample delay per pair
+	std::vector<std::map<long, double> > votes(phat.pairs());
+	size_t blocks = 0;
+
+	sf_count_t count;
+	while ((count = sf_readf_float(in, frames.data(), block)) > 0) {
+		phat.process_block(frames.data(), count, delays);
+		printf("block %d:", (int)blocks);
+		for (size_t p = 0; p < delays.size(); p++) {
+			printf(" %d-%d %.2f (%.2f)", (int)delays[p].first,
+				(int)delays[p].second, delays[p].delay, delays[p].value);
+			votes[p][lround(delays[p].delay)] += delays[p].value;
+		}
+		printf("\n");
+		blocks++;
+	}
+	if (sf_error(in)) {
+		fprintf(stderr, "failed to read input %s\n", sf_strerror(in));
+	}
+	sf_close(in);
+
+	printf("over %d blocks:\n", (int)blocks);
+	for (size_t p = 0; p < delays.size(); p++) {
+		long best = 0;
+		double weight = -1;
+		for (std::map<long, double>::iterator it = votes[p].begin();
+			it != votes[p].end(); ++it)
+		{
+			if (it->second > weight) {
+				best = it->first;
+				weight = it->second;
+			}
+		}
+		printf("%d-%d %ld samples, %.3f ms\n", (int)delays[p].first,
+			(int)delays[p].second, best, 1000.0 * best / info.samplerate);
+	}
+	return EXIT_SUCCESS;
+}
@@ -5,6 +5,9 @@
 #include "convolution.hh"
 #include "correlation.hh"
 #include "fft.hh"
+#include "fft_simd.hh"
+#include "fir.hh"
+#include "ntt.hh"
 #include "windowfunction.hh"
 
 using namespace std;
@@ -32,6 +35,114 @@ static void test_fft_1d(void) {
 	dump(ff2);
 }
 
+static void test_fft_plan(void) {
+	complex<test_float_t> ref[NUM_TEST_SAMPLES] = {0, 1, 2, 3, 4, 5, 6, 7};
+	complex<test_float_t> arr[NUM_TEST_SAMPLES] = {0, 1, 2, 3, 4, 5, 6, 7};
+	FftPlan<test_float_t> fwd(NUM_TEST_SAMPLES, false);
+	FftPlan<test_float_t> inv(NUM_TEST_SAMPLES, true);
+
+	fft<test_float_t, NUM_TEST_SAMPLES, false>(ref);
+	fwd.execute(arr);
+	cout << "FFT plan" << endl;
+	dump(arr);
+
+	test_float_t err = 0;
+	for (size_t i = 0; i < NUM_TEST_SAMPLES; i++) {
+		err = max(err, abs(ref[i] - arr[i]));
+	}
+	inv.execute(arr);
+	cout << "after inverse plan" << endl;
+	dump(arr);
+	cout << "max difference to fft: " << err << endl;
+
+	const FftAlgorithm algorithms[] = {FFT_RADIX2, FFT_RADIX4, FFT_SPLIT_RADIX,
+		FFT_STOCKHAM, FFT_FOUR_STEP};
+	const char *names[] = {"radix-2", "radix-4", "split radix",
+		"stockham", "four-step"};
+	for (size_t a = 0; a < 5; a++) {
+		FftPlan<test_float_t> plan(NUM_TEST_SAMPLES, false, algorithms[a]);
+		for (size_t i = 0; i < NUM_TEST_SAMPLES; i++) {
+			arr[i] = i;
+		}
+		plan.execute(arr);
+
+		err = 0;
+		for (size_t i = 0; i < NUM_TEST_SAMPLES; i++) {
+			err = max(err, abs(ref[i] - arr[i]));
+		}
+		cout << names[a] << " max difference to fft: " << err << endl;
+	}
+}
+
+static void test_rfft(void) {
+	test_float_t sig[NUM_TEST_SAMPLES] = {0, 1, 2, 3, 4, 5, 6, 7};
+	complex<test_float_t> spec[NUM_TEST_SAMPLES / 2 + 1];
+	rfft<test_float_t, NUM_TEST_SAMPLES>(sig, spec);
+	cout << "after real FFT" << endl;
+	dump(spec);
+	irfft<test_float_t, NUM_TEST_SAMPLES>(spec, sig);
+	cout << "after real IFFT" << endl;
+	dump(sig);
+}
+
+static void test_fft_sizes(void) {
+	const size_t sizes[] = {6, 7, 11};
+	cout << "FFT of sizes 6, 7, 11" << endl;
+	for (size_t i = 0; i < 3; i++) {
+		vector<complex<test_float_t> > arr(sizes[i]);
+		for (size_t j = 0; j < arr.size(); j++) {
+			arr[j] = j;
+		}
+		fft(arr.data(), arr.size(), false);
+		dump(arr);
+		fft(arr.data(), arr.size(), true);
+		dump(arr);
+	}
+}
+
+static void test_fft_codelet(void) {
+	static const size_t SIZE = 64;
+	complex<test_float_t> arr[SIZE], ref[SIZE];
+	for (size_t i = 0; i < SIZE; i++) {
+		arr[i] = ref[i] = i % 7;
+	}
+	fft<test_float_t, SIZE, false>(arr);
+	FftPlan<test_float_t>(SIZE, false).execute(ref);
+
+	test_float_t diff = 0;
+	for (size_t i = 0; i < SIZE; i++) {
+		diff = max(diff, abs(arr[i] - ref[i]));
+	}
+	cout << "64 point codelet vs plan, max difference " << diff << endl;
+}
+
+static void test_fft_fixed(void) {
+	FixedComplex<int16_t> arr[NUM_TEST_SAMPLES];
+	for (size_t i = 0; i < NUM_TEST_SAMPLES; i++) {
+		arr[i].re = 1000 * i;
+		arr[i].im = 0;
+	}
+	int exponent = FixedFftPlan<int16_t>(NUM_TEST_SAMPLES, false).execute(arr);
+	cout << "Q15 FFT of 1000 * {0, 1, ..., 7}, exponent " << exponent << endl;
+	cout << "[";
+	for (size_t i = 0; i < NUM_TEST_SAMPLES; i++) {
+		cout << "(" << ldexp(arr[i].re, exponent) << ","
+			<< ldexp(arr[i].im, exponent) << ") ";
+	}
+	cout << "]" << endl;
+}
+
+static void test_fft_simd(void) {
+	complex<test_float_t> arr[NUM_TEST_SAMPLES] = {0, 1, 2, 3, 4, 5, 6, 7};
+	SimdFftPlan<test_float_t> fwd(NUM_TEST_SAMPLES, false);
+	SimdFftPlan<test_float_t> inv(NUM_TEST_SAMPLES, true);
+	cout << "SIMD FFT, level " << fwd.level() << endl;
+	fwd.execute(arr);
+	dump(arr);
+	inv.execute(arr);
+	dump(arr);
+}
+
 static void test_fft_2d(void) {
 	complex<test_float_t> arr[] = {
 		1, 2, 3, 4,
@@ -59,6 +170,13 @@ static void test_convolution_1d(void) {
 	convolveCircular1D(f, g, circ);
 	cout << "1d circular convolution" << endl;
 	dump(circ);
+
+	vector<test_float_t> direct, fast;
+	convolve(f, g, direct, CONV_DIRECT);
+	convolve(f, g, fast, CONV_FFT);
+	cout << "1d linear convolution, direct and fft" << endl;
+	dump(direct);
+	dump(fast);
 }
 
 static void test_correlation_1d(void) {
@@ -70,6 +188,161 @@ static void test_correlation_1d(void) {
 	dump(cor);
 }
 
+static void test_correlation_fft(void) {
+	//a gaussian pulse, found in the signal at 40.3 and at 120 at half level
+	vector<test_float_t> pat(17), sig(200);
+	for (size_t i = 0; i < pat.size(); i++) {
+		pat[i] = exp(-pow((i - 8.0) / 3, 2));
+	}
+	for (size_t i = 0; i < sig.size(); i++) {
+		sig[i] = exp(-pow((i - 48.3) / 3, 2)) +
+			0.5 * exp(-pow((i - 128.0) / 3, 2));
+	}
+
+	vector<test_float_t> direct, fast;
+	correlate(sig, pat, direct, CONV_DIRECT);
+	correlate(sig, pat, fast, CONV_FFT);
+	test_float_t err = 0;
+	for (size_t i = 0; i < direct.size(); i++) {
+		err = max(err, fabs(direct[i] - fast[i]));
+	}
+	cout << "fft cross-correlation, " << fast.size() << " lags, " <<
+		(err < 1e-9 ? "matches" : "differs from") << " the direct sum" << endl;
+
+	vector<CorrelationPeak> peaks;
+	correlate_peaks(sig.data(), sig.size(), pat.data(), pat.size(),
+		2, peaks, true);
+	cout << "NCC peaks" << endl;
+	for (size_t i = 0; i < peaks.size(); i++) {
+		cout << "lag " << round(peaks[i].lag * 100) / 100 << " value " <<
+			round(peaks[i].value * 1000) / 1000 << endl;
+	}
+
+	//a ramp in silence scores 1, the neighbours at its edge are lopsided
+	vector<test_float_t> ramp = {1, 2, 3, 4, 5}, quiet(100, 0);
+	copy(ramp.begin(), ramp.end(), quiet.begin() + 20);
+	correlate_peaks(quiet.data(), quiet.size(), ramp.data(), ramp.size(),
+		1, peaks, true);
+	cout << "ramp at lag " << peaks[0].lag << " value " <<
+		peaks[0].value << (peaks[0].value <= 1 ? "" : " above 1") << endl;
+
+	//int16 range noise, the silence test must not depend on the amplitude
+	vector<test_float_t> noise(48000), excerpt(4800);
+	for (size_t i = 0; i < noise.size(); i++) {
+		noise[i] = rand() % 65535 - 32767;
+	}
+	copy(noise.begin() + 12345, noise.begin() + 12345 + excerpt.size(),
+		excerpt.begin());
+	correlate_peaks(noise.data(), noise.size(), excerpt.data(), excerpt.size(),
+		1, peaks, true);
+	cout << "int16 range excerpt at lag " << peaks[0].lag << " value " <<
+		peaks[0].value << endl;
+
+	//an oversampled burst 5000.4 samples in, its sampled NCC is just
+	//below 1 and the parabola still has to find the fraction
+	vector<test_float_t> burst(2001), delayed(10000);
+	for (size_t i = 0; i < delayed.size(); i++) {
+		double t = i - 5000.4;
+		delayed[i] = t < 0 || t > 2000 ? 0 :
+			sin(2 * M_PI * t / 4000) * pow(sin(M_PI * t / 2000), 2);
+		if (i < burst.size()) {
+			burst[i] = sin(2 * M_PI * i / 4000.0) *
+				pow(sin(M_PI * i / 2000.0), 2);
+		}
+	}
+	correlate_peaks(delayed.data(), delayed.size(), burst.data(), burst.size(),
+		1, peaks, true);
+	cout << "burst at lag " << round(peaks[0].lag * 1000) / 1000 << endl;
+}
+
+static void test_correlator_bank(void) {
+	//a rising and a falling ramp, each shows up once in the stream
+	vector<vector<test_float_t> > templates(2);
+	templates[0] = {1, 2, 3, 4, 5};
+	templates[1] = {3, 2, 1};
+	vector<test_float_t> sig(100, 0);
+	for (size_t i = 0; i < templates[0].size(); i++) {
+		sig[20 + i] = templates[0][i];
+	}
+	for (size_t i = 0; i < templates[1].size(); i++) {
+		sig[71 + i] = 2 * templates[1][i];
+	}
+
+	CorrelatorBank<test_float_t> bank(templates, 1, true);
+	for (size_t i = 0; i < sig.size(); i += 7) {
+		bank.push(sig.data() + i, min<size_t>(7, sig.size() - i));
+	}
+	bank.flush();
+	cout << "correlator bank, best NCC match per template" << endl;
+	for (size_t t = 0; t < bank.templates(); t++) {
+		vector<CorrelationPeak> peaks;
+		bank.peaks(t, peaks);
+		cout << "template " << t << " at " << peaks[0].lag << " value " <<
+			peaks[0].value << (peaks[0].value <= 1 ? "" : " above 1") << endl;
+	}
+}
+
+static void test_sliding_pitch(void) {
+	//a 250 Hz tone at 8 kHz, a period of 32 samples
+	const double rate = 8000;
+	SlidingAutocorrelator<test_float_t> ac(256, 100, 64);
+	vector<test_float_t> tone(64);
+	PitchEstimate est = {0, 0, 0};
+	bool voiced = false;
+	for (size_t hop = 0; hop < 8; hop++) {
+		for (size_t i = 0; i < tone.size(); i++) {
+			tone[i] = sin(2 * M_PI * 250 * (hop * tone.size() + i) / rate);
+		}
+		ac.push(tone.data(), tone.size());
+		voiced = ac.pitch(rate, est);
+	}
+	cout << "sliding autocorrelation pitch" << endl;
+	cout << (voiced ? "voiced " : "unvoiced ") <<
+		round(est.frequency * 10) / 10 << " Hz periodicity " <<
+		round(est.periodicity * 100) / 100 << endl;
+
+	//digital silence after loud noise leaves only rounding residue
+	SlidingAutocorrelator<test_float_t> loud(1200, 160, 400);
+	vector<test_float_t> hop_samples(400);
+	size_t silent_voiced = 0, silent_hops = 0;
+	for (size_t hop = 0; hop < 40; hop++) {
+		for (size_t i = 0; i < hop_samples.size(); i++) {
+			hop_samples[i] = hop < 20 ? (rand() % 65536 - 32768) : 0;
+		}
+		loud.push(hop_samples.data(), hop_samples.size());
+		if (hop >= 23) {
+			silent_hops++;
+			silent_voiced += loud.pitch(rate, est);
+		}
+	}
+	cout << "silence after noise voiced on " << silent_voiced << " of " <<
+		silent_hops << " hops" << endl;
+}
+
+static void test_gcc_phat(void) {
+	//one noise source reaching three mics 0, 5 and 2 samples late
+	const size_t frames = 256, channels = 3;
+	const size_t late[channels] = {0, 5, 2};
+	vector<test_float_t> source(frames + 8), data(frames * channels);
+	for (size_t i = 0; i < source.size(); i++) {
+		source[i] = (rand() % 2000 - 1000) / 1000.0;
+	}
+	for (size_t i = 0; i < frames; i++) {
+		for (size_t c = 0; c < channels; c++) {
+			data[i * channels + c] = source[8 + i - late[c]];
+		}
+	}
+
+	GccPhat<test_float_t> phat(channels, frames, 16);
+	vector<ChannelDelay> delays;
+	phat.process_block(data.data(), frames, delays);
+	cout << "GCC-PHAT channel delays" << endl;
+	for (size_t p = 0; p < delays.size(); p++) {
+		cout << delays[p].first << "-" << delays[p].second << " " <<
+			round(delays[p].delay) << endl;
+	}
+}
+
 static void test_lowpass(void) {
 	complex<test_float_t> sig[NUM_TEST_SAMPLES] =
 		{100, 200, 300, 400, 500, 600, 700, 800};
@@ -113,81 +386,148 @@ static void test_window(void) {
 	dump(foo);
 }
 
-#if 0
-template <class T, size_t sig_size, size_t flt_size>
-static void overlap_add(complex<test_float_t> *sig,
-	complex<test_float_t> *flt,
-	complex<test_float_t> *out)
-{
-	size_t y_idx = 0;
+static void test_window_registry(void) {
+	//shared tables, the same shape twice is the same table
+	vector<test_float_t> ones(8, 1);
+	WindowRegistry<test_float_t>::Table kaiser =
+		window_table<test_float_t>(WINDOW_KAISER, 8, 5);
+	WindowRegistry<test_float_t>::Table flat =
+		window_table<test_float_t>(WINDOW_FLAT_TOP, 8, -1, true);
+	cout << "window registry, shared " <<
+		(kaiser == window_table<test_float_t>(WINDOW_KAISER, 8, 5)) << endl;
+	kaiser->apply(ones.data());
+	cout << "[";
+	for (size_t i = 0; i < ones.size(); i++) {
+		cout << round(ones[i] * 1000) / 1000 << " ";
+	}
+	cout << "]" << endl;
+	cout << "[";
+	for (size_t i = 0; i < flat->length(); i++) {
+		cout << round((*flat)[i] * 1000) / 1000 + 0 << " ";
+	}
+	cout << "]" << endl;
+}
 
-	size_t L = 1;
-	size_t M = next_power_of_two(flt_size);
-	size_t N = next_power_of_two(L + M - 1);
-	size_t out_size = sig_size + M - 1;
+static void test_ola(void) {
+	test_float_t sig[NUM_TEST_SAMPLES] = {100, 100, 100, 200, 300, 400, 500, 600};
+	static const size_t FLT_SIZE = 7;
+	static const size_t OUT_SIZE = NUM_TEST_SAMPLES + FLT_SIZE - 1;
+	test_float_t flt[FLT_SIZE] = {0, 1, 0, 0, 0, 0, 0};
 
-	auto buf = new complex<test_float_t>[N];
-	auto h = new complex<test_float_t>[M];
+	const BlockConvolutionMethod methods[] = {OVERLAP_ADD, OVERLAP_SAVE};
+	const char *names[] = {"overlap-add", "overlap-save"};
+	for (size_t m = 0; m < 2; m++) {
+		BlockConvolver<test_float_t> conv(flt, FLT_SIZE, methods[m]);
+		//blocks of any length go in, the rest comes out on flush
+		conv.push(sig, 3);
+		conv.push(sig + 3, NUM_TEST_SAMPLES - 3);
+		conv.flush();
 
-	fill_n(out, out_size, 0);
-	fill_n(h, M, 0);
-	for (size_t i = 0; i < flt_size; i++) {
-		h[i] = flt[i];
+		test_float_t out[OUT_SIZE];
+		size_t count = conv.pull(out, OUT_SIZE);
+		cout << names[m] << ", fft size " << conv.fft_size() << endl;
+		cout << "[";
+		for (size_t i = 0; i < count; i++) {
+			cout << round(out[i]) + 0 << " ";
+		}
+		cout << "]" << endl;
 	}
-	fft<test_float_t, M, false>(h);
+}
 
-	for (size_t x_idx = 0; x_idx < sig_size; x_idx += L) {
-		//pad with zeroes
-		fill_n(buf, N, 0);
-		for (size_t i = 0; i < L; i++) {
-			buf[i] = sig[x_idx + i];
-		}
-		fft(buf, N, false);
-		
-		for (size_t i = 0; i < M; i++) {
-			buf[i] *= h[i];
-		}
-		fft(buf, N, true);
+static void test_partitioned(void) {
+	static const size_t FLT_SIZE = 20;
+	static const size_t BLOCK = 4;
+	test_float_t flt[FLT_SIZE] = {0};
+	flt[1] = 1;
+	flt[17] = 0.5;
+	test_float_t sig[2 * NUM_TEST_SAMPLES + FLT_SIZE] =
+		{100, 100, 100, 200, 300, 400, 500, 600};
 
-		size_t ymax = min(N, out_size - y_idx);
-		for (size_t i = 0; i < ymax; i++) {
-			out[i + y_idx] += buf[i];
+	//partitions of 4, 4, 4, 4 and 8 taps, one block of latency
+	PartitionedConvolver<test_float_t> conv(flt, FLT_SIZE, BLOCK, 8);
+	cout << "partitioned convolution" << endl;
+	cout << "[";
+	for (size_t i = 0; i + BLOCK <= sizeof(sig) / sizeof(sig[0]); i += BLOCK) {
+		test_float_t out[BLOCK];
+		conv.process_block(sig + i, out);
+		for (size_t j = 0; j < BLOCK; j++) {
+			cout << round(out[j]) + 0 << " ";
 		}
-
-		y_idx += L;
 	}
-	
-	delete[] h;
-	delete[] buf;
+	cout << "]" << endl;
 }
 
-static void test_ola(void) {
-	complex<test_float_t> sig[NUM_TEST_SAMPLES]= {100, 100, 100, 200, 300, 400, 500, 600};
-	static const size_t FLT_SIZE = 7;
-	static const size_t OUT_SIZE = NUM_TEST_SAMPLES + FLT_SIZE - 1;
-	complex<test_float_t> flt[FLT_SIZE] = {0, 1, 0, 0, 0, 0, 0};
-	complex<test_float_t> out[OUT_SIZE];
-	overlap_add<test_float_t, NUM_TEST_SAMPLES, FLT_SIZE>(sig, flt, out);
-	
+static void test_fir(void) {
+	test_float_t sig[NUM_TEST_SAMPLES] = {100, 100, 100, 200, 300, 400, 500, 600};
+	test_float_t avg[4] = {0.25, 0.25, 0.25, 0.25};
+	test_float_t out[NUM_TEST_SAMPLES];
+
+	FirFilter<test_float_t> fir(avg, 4);
+	//the history carries over between the two blocks
+	fir.process(sig, out, 3);
+	fir.process(sig + 3, out + 3, NUM_TEST_SAMPLES - 3);
+	cout << "FIR moving average, level " << fir.level() << endl;
+	dump(out);
+
+	int16_t sig16[NUM_TEST_SAMPLES] = {1000, -1000, 1000, -1000,
+		1000, -1000, 1000, -1000};
+	int16_t half[2] = {16384, 16384};
+	int16_t out16[NUM_TEST_SAMPLES];
+	FirFilter<int16_t> fir16(half, 2);
+	fir16.process(sig16, out16, NUM_TEST_SAMPLES);
+	cout << "Q15 FIR, the alternating part cancels" << endl;
 	cout << "[";
-	for (size_t i = 0; i < OUT_SIZE; i++) {
-		cout << out[i].real() << " ";
+	for (size_t i = 0; i < NUM_TEST_SAMPLES; i++) {
+		cout << out16[i] << " ";
 	}
 	cout << "]" << endl;
-};
-#else
-static void test_ola(void) {}
-#endif
+}
+
+static void test_poly_multiply(void) {
+	//(10^9 + x + ... + 3 * 10^9 x^63) * (10^9 - x - ... + 3 * 10^9 x^63),
+	//coefficients past 2^53 where a double FFT cannot be exact
+	static const size_t TERMS = 64;
+	vector<int64_t> a(TERMS, 1), b(TERMS, -1), prod;
+	a[0] = 1000000000;
+	b[0] = 1000000000;
+	a[TERMS - 1] = b[TERMS - 1] = 3000000000LL;
+	poly_multiply(a, b, prod);
+
+	vector<int64_t> ref(2 * TERMS - 1, 0);
+	for (size_t i = 0; i < TERMS; i++) {
+		for (size_t j = 0; j < TERMS; j++) {
+			ref[i + j] += a[i] * b[j];
+		}
+	}
+	cout << "NTT polynomial product, " << prod.size() << " terms, " <<
+		(prod == ref ? "exact" : "wrong") << endl;
+	cout << "x^0: " << prod[0] << " x^63: " << prod[TERMS - 1] <<
+		" x^126: " << prod[2 * TERMS - 2] << endl;
+}
 
 int main() {
 	test_convolution_1d();
 	test_correlation_1d();
+	test_correlation_fft();
+	test_correlator_bank();
+	test_sliding_pitch();
+	test_gcc_phat();
 	test_fft_1d();
+	test_fft_plan();
+	test_rfft();
+	test_fft_sizes();
+	test_fft_codelet();
+	test_fft_fixed();
+	test_fft_simd();
 	test_fft_2d();
 	test_lowpass();
 	test_hipass();
 	test_window();
+	test_window_registry();
 	test_ola();
+	test_partitioned();
+	test_fir();
+	test_poly_multiply();
 
 	return 0;
 }
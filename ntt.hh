@@ -0,0 +1,397 @@
+#ifndef __NTT_HH__
+#define __NTT_HH__
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+
+#include "bit_hacks.hh"
+
+/*
+ * Number theoretic transform: the FFT over the integers modulo a prime
+ * p = c * 2^k + 1, where a primitive 2^k-th root of unity takes the
+ * place of exp(-2 * pi * i / size). There is no rounding, products of
+ * integer polynomials come out exact modulo p, and with the residues
+ * for two or three primes combined by the Chinese remainder theorem
+ * exact over the integers up to about 2^88.
+ *
+ * The transform is the radix-2 decimation in time of fft() after the
+ * same bit reversal permutation, with two stages fused per pass over
+ * the data like FftPlan's radix-4. Twiddles are multiplied with Shoup's
+ * method: w' = floor(w * 2^32 / p) is stored next to w, so x * w mod p
+ * is two multiplications and a conditional subtraction.
+ */
+
+//schoolbook multiplication below this many terms of the shorter factor
+#ifndef NTT_DIRECT_MAX_TERMS
+	#define NTT_DIRECT_MAX_TERMS 32
+#endif
+
+struct NttPrime {
+	uint32_t mod;
+	//a generator of the multiplicative group
+	uint32_t root;
+	//largest power of two transform size
+	unsigned max_log2;
+};
+
+//the CRT combination uses them in this order
+static const NttPrime NTT_PRIMES[] = {
+	{998244353, 3, 23},
+	{167772161, 3, 25},
+	{469762049, 3, 26},
+};
+#define NTT_NUM_PRIMES 3
+
+static inline uint32_t ntt_mul_mod(uint32_t a, uint32_t b, uint32_t mod) {
+	return static_cast<uint32_t>(static_cast<uint64_t>(a) * b % mod);
+}
+
+static inline uint32_t ntt_pow_mod(uint32_t a, uint64_t e, uint32_t mod) {
+	uint32_t ret = 1;
+	for (; e; e >>= 1) {
+		if (e & 1) {
+			ret = ntt_mul_mod(ret, a, mod);
+		}
+		a = ntt_mul_mod(a, a, mod);
+	}
+	return ret;
+}
+
+//inverse modulo a prime
+static inline uint32_t ntt_inv_mod(uint32_t a, uint32_t mod) {
+	return ntt_pow_mod(a, mod - 2, mod);
+}
+
+//x * w mod p with wp = floor(w * 2^32 / p), x < 2^32 and p < 2^31
+static inline uint32_t ntt_mul_shoup(uint32_t x, uint32_t w, uint32_t wp,
+	uint32_t mod)
+{
+	uint32_t q = static_cast<uint32_t>((static_cast<uint64_t>(x) * wp) >> 32);
+	uint32_t r = x * w - q * mod;
+	return r >= mod ? r - mod : r;
+}
+
+//x mod p for any 64-bit x through a precomputed floor((2^64 - 1) / p)
+struct NttReducer {
+	uint32_t mod;
+	uint64_t factor;
+
+	NttReducer(uint32_t mod) : mod(mod), factor(~uint64_t(0) / mod) {}
+
+	inline uint32_t reduce(uint64_t x) const {
+		uint64_t q = static_cast<uint64_t>(
+			(static_cast<unsigned __int128>(x) * factor) >> 64);
+		//q is at most 2 short of x / p
+		uint64_t r = x - q * mod;
+		r = r >= mod ? r - mod : r;
+		return static_cast<uint32_t>(r >= mod ? r - mod : r);
+	}
+};
+
+static inline uint32_t ntt_add(uint32_t a, uint32_t b, uint32_t mod) {
+	uint32_t r = a + b;
+	return r >= mod ? r - mod : r;
+}
+
+static inline uint32_t ntt_sub(uint32_t a, uint32_t b, uint32_t mod) {
+	return a >= b ? a - b : a + mod - b;
+}
+
+/*
+ * Power-of-two size NTT modulo one of NTT_PRIMES on residues in
+ * [0, p). The inverse is scaled by 1 / size like the FFT.
+ */
+class NttPlan {
+protected:
+	size_t mSize;
+	bool mInverse;
+	uint32_t mMod;
+	//size^-1 mod p and its Shoup companion
+	uint32_t mScale;
+	uint32_t mScaleShoup;
+	//per stage of half size h: w_2h^k for k < h, at offset h - 1
+	std::vector<uint32_t> mTwiddles;
+	std::vector<uint32_t> mTwiddlesShoup;
+	std::vector<size_t> mBitrev;
+
+	static uint32_t shoup(uint32_t w, uint32_t mod) {
+		return static_cast<uint32_t>((static_cast<uint64_t>(w) << 32) / mod);
+	}
+
+public:
+	NttPlan(size_t size, bool inverse, const NttPrime &prime = NTT_PRIMES[0])
+		: mSize(size), mInverse(inverse), mMod(prime.mod),
+		mTwiddles(size ? size - 1 : 0), mTwiddlesShoup(size ? size - 1 : 0),
+		mBitrev(size)
+	{
+		unsigned bits = 0;
+		while ((size_t(1) << bits) < size) {
+			bits++;
+		}
+		for (size_t i = 0; i < size; i++) {
+			mBitrev[i] = reverse_bits(i, bits);
+		}
+
+		for (size_t h = 1; h < size; h *= 2) {
+			//a primitive 2h-th root of unity
+			uint32_t w = ntt_pow_mod(prime.root, (mMod - 1) / (2 * h), mMod);
+			if (inverse) {
+				w = ntt_inv_mod(w, mMod);
+			}
+			uint32_t wk = 1;
+			for (size_t k = 0; k < h; k++) {
+				mTwiddles[h - 1 + k] = wk;
+				mTwiddlesShoup[h - 1 + k] = shoup(wk, mMod);
+				wk = ntt_mul_mod(wk, w, mMod);
+			}
+		}
+
+		mScale = ntt_inv_mod(size ? size % mMod : 1, mMod);
+		mScaleShoup = shoup(mScale, mMod);
+	}
+
+	inline size_t size() const {
+		return mSize;
+	}
+
+	inline uint32_t mod() const {
+		return mMod;
+	}
+
+	//largest size the prime allows
+	static size_t max_size(const NttPrime &prime) {
+		return size_t(1) << prime.max_log2;
+	}
+
+	void execute(uint32_t *arr) const {
+		const uint32_t mod = mMod;
+		bitreversal_auto(arr, mSize, mBitrev.data());
+
+		size_t stages = 0;
+		while ((size_t(1) << stages) < mSize) {
+			stages++;
+		}
+
+		//an odd stage out first, its only twiddle is 1
+		size_t h = 1;
+		if (stages & 1) {
+			for (size_t i = 0; i < mSize; i += 2) {
+				uint32_t x = arr[i], y = arr[i + 1];
+				arr[i] = ntt_add(x, y, mod);
+				arr[i + 1] = ntt_sub(x, y, mod);
+			}
+			h = 2;
+		}
+
+		//two radix-2 stages per pass over the data
+		for (; h < mSize; h *= 4) {
+			const uint32_t *w1 = mTwiddles.data() + h - 1;
+			const uint32_t *w1p = mTwiddlesShoup.data() + h - 1;
+			const uint32_t *w2 = mTwiddles.data() + 2 * h - 1;
+			const uint32_t *w2p = mTwiddlesShoup.data() + 2 * h - 1;
+			for (size_t start = 0; start < mSize; start += 4 * h) {
+				uint32_t *x0 = arr + start, *x1 = x0 + h;
+				uint32_t *x2 = x1 + h, *x3 = x2 + h;
+				for (size_t k = 0; k < h; k++) {
+					//stage h on (x0, x1) and (x2, x3)
+					uint32_t t = ntt_mul_shoup(x1[k], w1[k], w1p[k], mod);
+					uint32_t b0 = ntt_add(x0[k], t, mod);
+					uint32_t b1 = ntt_sub(x0[k], t, mod);
+					t = ntt_mul_shoup(x3[k], w1[k], w1p[k], mod);
+					uint32_t b2 = ntt_add(x2[k], t, mod);
+					uint32_t b3 = ntt_sub(x2[k], t, mod);
+
+					//stage 2h on (b0, b2) and (b1, b3)
+					t = ntt_mul_shoup(b2, w2[k], w2p[k], mod);
+					x0[k] = ntt_add(b0, t, mod);
+					x2[k] = ntt_sub(b0, t, mod);
+					t = ntt_mul_shoup(b3, w2[h + k], w2p[h + k], mod);
+					x1[k] = ntt_add(b1, t, mod);
+					x3[k] = ntt_sub(b1, t, mod);
+				}
+			}
+		}
+
+		if (mInverse) {
+			for (size_t i = 0; i < mSize; i++) {
+				arr[i] = ntt_mul_shoup(arr[i], mScale, mScaleShoup, mod);
+			}
+		}
+	}
+};
+
+//per-thread plans like fft_cached_plan()
+static inline NttPlan &ntt_cached_plan(size_t size, size_t prime,
+	bool inverse)
+{
+	typedef std::map<std::pair<size_t, int>, std::unique_ptr<NttPlan> >
+		PlanMap;
+	static thread_local PlanMap plans;
+
+	int key = 2 * static_cast<int>(prime) + inverse;
+	std::unique_ptr<NttPlan> &plan = plans[std::make_pair(size, key)];
+	if (!plan) {
+		plan.reset(new NttPlan(size, inverse, NTT_PRIMES[prime]));
+	}
+	return *plan;
+}
+
+/*
+ * Product of residues modulo NTT_PRIMES[prime], out holds na + nb - 1
+ * terms. Products longer than NttPlan::max_size() of the prime, which
+ * has no root of unity of a larger order, are split into blocks of
+ * half that size and summed.
+ */
+static inline void ntt_multiply_mod(const uint32_t *a, size_t na,
+	const uint32_t *b, size_t nb, uint32_t *out, size_t prime = 0)
+{
+	if (!na || !nb) {
+		return;
+	}
+	size_t nout = na + nb - 1;
+	size_t limit = NttPlan::max_size(NTT_PRIMES[prime]);
+	if (nout > limit) {
+		uint32_t mod = NTT_PRIMES[prime].mod;
+		size_t block = limit / 2;
+		std::vector<uint32_t> part(2 * block - 1);
+		std::fill(out, out + nout, 0);
+		for (size_t i = 0; i < na; i += block) {
+			size_t ni = std::min(block, na - i);
+			for (size_t j = 0; j < nb; j += block) {
+				size_t nj = std::min(block, nb - j);
+				ntt_multiply_mod(a + i, ni, b + j, nj, part.data(), prime);
+				uint32_t *dst = out + i + j;
+				for (size_t k = 0; k < ni + nj - 1; k++) {
+					dst[k] = ntt_add(dst[k], part[k], mod);
+				}
+			}
+		}
+		return;
+	}
+
+	size_t size = next_power_of_two(nout);
+	NttReducer reducer(NTT_PRIMES[prime].mod);
+
+	std::vector<uint32_t> fa(size, 0), fb(size, 0);
+	std::copy(a, a + na, fa.begin());
+	std::copy(b, b + nb, fb.begin());
+	NttPlan &forward = ntt_cached_plan(size, prime, false);
+	forward.execute(fa.data());
+	forward.execute(fb.data());
+	for (size_t i = 0; i < size; i++) {
+		fa[i] = reducer.reduce(static_cast<uint64_t>(fa[i]) * fb[i]);
+	}
+	ntt_cached_plan(size, prime, true).execute(fa.data());
+	std::copy(fa.begin(), fa.begin() + nout, out);
+}
+
+//residues of signed coefficients
+template <class T>
+static void ntt_residues(const T *in, size_t n, uint32_t mod, uint32_t *out) {
+	NttReducer reducer(mod);
+	for (size_t i = 0; i < n; i++) {
+		int64_t x = static_cast<int64_t>(in[i]);
+		if (x < 0) {
+			uint32_t r = reducer.reduce(-static_cast<uint64_t>(x));
+			out[i] = r ? mod - r : 0;
+		}
+		else {
+			out[i] = reducer.reduce(static_cast<uint64_t>(x));
+		}
+	}
+}
+
+/*
+ * Exact product of integer polynomials, coefficient i of a is the
+ * factor of x^i. The number of primes follows from a bound on the
+ * result coefficients, the result must fit in T (int32_t or int64_t)
+ * like for a scalar multiplication. Short factors are multiplied
+ * directly. Any length works: products past 2^23 terms, the largest
+ * transform of NTT_PRIMES[0], are done in blocks (ntt_multiply_mod).
+ */
+template <class T>
+static void poly_multiply(const std::vector<T> &a, const std::vector<T> &b,
+	std::vector<T> &ret)
+{
+	size_t na = a.size(), nb = b.size();
+	ret.assign(na && nb ? na + nb - 1 : 0, T(0));
+	if (!na || !nb) {
+		return;
+	}
+
+	if (std::min(na, nb) <= NTT_DIRECT_MAX_TERMS) {
+		for (size_t i = 0; i < na; i++) {
+			for (size_t j = 0; j < nb; j++) {
+				ret[i + j] += a[i] * b[j];
+			}
+		}
+		return;
+	}
+
+	//|result| <= min(na, nb) * max|a| * max|b|, in bits
+	double max_a = 0, max_b = 0;
+	for (size_t i = 0; i < na; i++) {
+		max_a = std::max(max_a, fabs(static_cast<double>(a[i])));
+	}
+	for (size_t i = 0; i < nb; i++) {
+		max_b = std::max(max_b, fabs(static_cast<double>(b[i])));
+	}
+	double bound = 2 * std::min(na, nb) * max_a * max_b + 1;
+	size_t primes = 1;
+	double range = NTT_PRIMES[0].mod;
+	while (primes < NTT_NUM_PRIMES && range <= bound) {
+		range *= NTT_PRIMES[primes].mod;
+		primes++;
+	}
+
+	size_t nout = na + nb - 1;
+	std::vector<std::vector<uint32_t> > res(primes,
+		std::vector<uint32_t>(nout));
+	std::vector<uint32_t> ra(na), rb(nb);
+	for (size_t p = 0; p < primes; p++) {
+		uint32_t mod = NTT_PRIMES[p].mod;
+		ntt_residues(a.data(), na, mod, ra.data());
+		ntt_residues(b.data(), nb, mod, rb.data());
+		ntt_multiply_mod(ra.data(), na, rb.data(), nb, res[p].data(), p);
+	}
+
+	/*
+	 * Garner: x = r0 + p0 * (t1 + p1 * t2) with the t picked so that x
+	 * matches every residue, then the upper half of [0, p0 * p1 * p2)
+	 * is taken as negative.
+	 */
+	const uint64_t p0 = NTT_PRIMES[0].mod;
+	const uint64_t p1 = NTT_PRIMES[1].mod;
+	const uint64_t p2 = NTT_PRIMES[2].mod;
+	const uint32_t inv_p0_p1 = ntt_inv_mod(p0 % p1, p1);
+	const uint32_t inv_p0p1_p2 = ntt_inv_mod((p0 * p1) % p2, p2);
+	unsigned __int128 full = primes == 1 ? p0 : primes == 2 ? p0 * p1 :
+		static_cast<unsigned __int128>(p0 * p1) * p2;
+
+	for (size_t i = 0; i < nout; i++) {
+		//x < p0 * p1 < 2^58 until the last step
+		uint64_t x01 = res[0][i];
+		if (primes > 1) {
+			uint64_t r0 = res[0][i] % p1;
+			uint64_t t1 = (res[1][i] + p1 - r0) % p1 * inv_p0_p1 % p1;
+			x01 += p0 * t1;
+		}
+		unsigned __int128 x = x01;
+		if (primes > 2) {
+			uint64_t t2 = (res[2][i] + p2 - x01 % p2) % p2 * inv_p0p1_p2 % p2;
+			x += static_cast<unsigned __int128>(p0 * p1) * t2;
+		}
+		if (x > full / 2) {
+			ret[i] = static_cast<T>(-static_cast<__int128>(full - x));
+		}
+		else {
+			ret[i] = static_cast<T>(x);
+		}
+	}
+}
+
+#endif
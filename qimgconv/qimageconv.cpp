@@ -117,16 +117,20 @@ void DspWidget :: convolveFFT(void) {
     //image dimensions
     int w = outputImage->width();
     int h = outputImage->height();
-    int dim = next_power_of_two(w > h ? w : h);
-
-    int chan_size = dim * dim;
 
     //kernel dimensions
     int user_kern_w = kernelTable->columnCount();
     int user_kern_h = kernelTable->rowCount();
 
-    int kern_w = dim;
-    int kern_h = dim;
+    //zero padded past the kernel so the product is a linear, not a
+    //circular convolution; fft_2d handles any size, each axis only
+    //goes up to the next 2^a 3^b 5^c
+    int pad_w = fft_fast_size(w + user_kern_w - 1);
+    int pad_h = fft_fast_size(h + user_kern_h - 1);
+    int chan_size = pad_w * pad_h;
+
+    int kern_w = pad_w;
+    int kern_h = pad_h;
 
     auto kernel = new std::complex<double>[kern_w * kern_h];
     Q_ASSERT(kernel != NULL);
@@ -163,10 +167,16 @@ void DspWidget :: convolveFFT(void) {
             kernel[ki + j] /= sum;
         }
     }
-    fft_2d(kernel, kern_w, kern_h, false);
+    fft_2d(kernel, kern_w, kern_h, false, 0);
+
+    //the inverse transforms are unnormalized, their 1/N is folded
+    //into the kernel spectrum once instead of once per channel
+    for (int i = 0; i < kern_w * kern_h; i++) {
+        kernel[i] /= chan_size;
+    }
 
     for (int i = 0; i < h; i++) {
-        int r_idx = dim * i;
+        int r_idx = pad_w * i;
         int g_idx = chan_size + r_idx;
         int b_idx = 2 * chan_size + r_idx;
 
@@ -178,15 +188,15 @@ void DspWidget :: convolveFFT(void) {
         }
     }
 
-    fft_2d(image, dim, dim, false);
-    fft_2d(image + chan_size, dim, dim, false);
-    fft_2d(image + 2 * chan_size, dim, dim, false);
+    fft_2d(image, pad_w, pad_h, false, 0);
+    fft_2d(image + chan_size, pad_w, pad_h, false, 0);
+    fft_2d(image + 2 * chan_size, pad_w, pad_h, false, 0);
 
-    for (int i = 0; i < dim; i++) {
-        int r_pad = dim * i;
+    for (int i = 0; i < pad_h; i++) {
+        int r_pad = pad_w * i;
         int g_pad = chan_size + r_pad;
         int b_pad = 2 * chan_size + r_pad;
-        for (int j = 0; j < dim; j++) {
+        for (int j = 0; j < pad_w; j++) {
             image[r_pad + j] *= kernel[r_pad + j];
             image[g_pad + j] *= kernel[r_pad + j];
             image[b_pad + j] *= kernel[r_pad + j];
@@ -194,12 +204,13 @@ void DspWidget :: convolveFFT(void) {
     }
 
     //FIXME: perform convolution
-    fft_2d(image, dim, dim, true);
-    fft_2d(image + chan_size, dim, dim, true);
-    fft_2d(image + 2 * chan_size, dim, dim, true);
+    fft_2d(image, pad_w, pad_h, true, 0, FFT_UNNORMALIZED);
+    fft_2d(image + chan_size, pad_w, pad_h, true, 0, FFT_UNNORMALIZED);
+    fft_2d(image + 2 * chan_size, pad_w, pad_h, true, 0, FFT_UNNORMALIZED);
 
+    //crop back to the image
     for (int i = 0; i < h; i++) {
-        int r_idx = dim * i;
+        int r_idx = pad_w * i;
         int g_idx = chan_size + r_idx;
         int b_idx = 2 * chan_size + r_idx;
 
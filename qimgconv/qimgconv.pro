@@ -7,7 +7,8 @@ TARGET =
 DEPENDPATH += .
 INCLUDEPATH += .
 
-QMAKE_CXXFLAGS += -std=c++0x -U__STRICT_ANSI__
+QMAKE_CXXFLAGS += -std=c++0x -U__STRICT_ANSI__ -fopenmp
+QMAKE_LFLAGS += -fopenmp
 
 CONFIG += static
 
@@ -0,0 +1,56 @@
+#include <cstdlib>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "../timelog.hh"
+#include "../convolution.hh"
+
+typedef float TestType;
+
+/*
+ * Times the direct and the FFT convolution of a signal with kernels of
+ * growing length, the crossover is where CONV_FFT_COST should put it.
+ * usage: conv_1d [signal size] [max taps]
+ */
+static void runTest(size_t nf, size_t ng, ConvolutionMethod method,
+	const char *name)
+{
+	std::vector<TestType> f(nf), g(ng), out;
+	for (size_t i = 0; i < nf; i++) {
+		f[i] = rand() % 100;
+	}
+	for (size_t i = 0; i < ng; i++) {
+		g[i] = rand() % 100;
+	}
+
+	//about the same amount of work for every size
+	size_t rounds = std::max<size_t>(1, (size_t)(4e8 / ((double)nf * ng)));
+	if (method == CONV_FFT) {
+		rounds = std::max<size_t>(1, (size_t)(2e7 / (nf + ng)));
+	}
+
+	std::stringstream title;
+	title << name << " " << nf << " samples " << ng << " taps x " << rounds;
+	std::string str = title.str();
+	DefaultTimeLog log(str);
+	for (size_t i = 0; i < rounds; i++) {
+		convolve(f, g, out, method);
+	}
+	log.stop();
+}
+
+int main(int argc, char **argv) {
+	size_t nf = argc > 1 ? atoi(argv[1]) : (1 << 16);
+	size_t max_taps = argc > 2 ? atoi(argv[2]) : 4096;
+
+	for (size_t ng = 16; ng <= max_taps; ng *= 2) {
+		runTest(nf, ng, CONV_DIRECT, "direct");
+		runTest(nf, ng, CONV_FFT, "fft");
+		std::cerr << "auto picks " <<
+			(convolution_method(nf, ng) == CONV_FFT ? "fft" : "direct")
+			<< std::endl;
+	}
+	return 0;
+}
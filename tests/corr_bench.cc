@@ -0,0 +1,60 @@
+#include <cstdlib>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "../timelog.hh"
+#include "../correlation.hh"
+
+typedef float TestType;
+
+/*
+ * Finds an excerpt of a noise recording in the recording, the way two
+ * captures of the same audio are aligned, with the direct and the FFT
+ * cross-correlation. The direct sum only runs while it takes seconds.
+ * usage: corr_bench [recording size] [excerpt size]
+ */
+static void runTest(const std::vector<TestType> &f,
+	const std::vector<TestType> &g, size_t offset,
+	ConvolutionMethod method, const char *name)
+{
+	std::stringstream title;
+	title << name << " ncc " << f.size() << " samples " << g.size() <<
+		" template";
+	std::string str = title.str();
+	std::vector<CorrelationPeak> peaks;
+	DefaultTimeLog log(str);
+	correlate_peaks(f.data(), f.size(), g.data(), g.size(), 3, peaks,
+		true, method);
+	log.stop();
+
+	std::cerr.precision(10);
+	std::cerr << "expected lag " << offset;
+	for (size_t i = 0; i < peaks.size(); i++) {
+		std::cerr << ", " << peaks[i].lag << " (" << peaks[i].value << ")";
+	}
+	std::cerr << std::endl;
+}
+
+int main(int argc, char **argv) {
+	//a minute and five seconds at 48kHz
+	size_t nf = argc > 1 ? atoi(argv[1]) : 48000 * 60;
+	size_t ng = argc > 2 ? atoi(argv[2]) : 48000 * 5;
+
+	std::vector<TestType> f(nf), g(ng);
+	for (size_t i = 0; i < nf; i++) {
+		f[i] = (rand() % 2000 - 1000) / 1000.0;
+	}
+	size_t offset = rand() % (nf - ng + 1);
+	for (size_t i = 0; i < ng; i++) {
+		//the second capture is quieter and noisier
+		g[i] = 0.5 * f[offset + i] + (rand() % 200 - 100) / 1000.0;
+	}
+
+	if ((double)nf * ng < 1e10) {
+		runTest(f, g, offset, CONV_DIRECT, "direct");
+	}
+	runTest(f, g, offset, CONV_FFT, "fft");
+	return 0;
+}
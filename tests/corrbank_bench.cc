@@ -0,0 +1,70 @@
+#include <cstdlib>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "../timelog.hh"
+#include "../correlation.hh"
+
+typedef float TestType;
+
+/*
+ * Scans a noise signal for many templates hidden in it, once with one
+ * correlate_peaks() per template and once with a CorrelatorBank that
+ * shares the signal spectrum between them.
+ * usage: corrbank_bench [templates] [template size] [signal size]
+ */
+int main(int argc, char **argv) {
+	size_t count = argc > 1 ? atoi(argv[1]) : 32;
+	size_t ng = argc > 2 ? atoi(argv[2]) : 1024;
+	size_t nf = argc > 3 ? atoi(argv[3]) : 48000 * 10;
+
+	std::vector<TestType> f(nf);
+	for (size_t i = 0; i < nf; i++) {
+		f[i] = (rand() % 2000 - 1000) / 1000.0;
+	}
+	std::vector<std::vector<TestType> > templates(count,
+		std::vector<TestType>(ng));
+	std::vector<size_t> offsets(count);
+	for (size_t t = 0; t < count; t++) {
+		offsets[t] = rand() % (nf - ng + 1);
+		for (size_t i = 0; i < ng; i++) {
+			templates[t][i] = f[offsets[t] + i];
+		}
+	}
+
+	std::vector<CorrelationPeak> peaks;
+	size_t found = 0;
+	std::stringstream title;
+	title << "one at a time " << count << " templates " << ng <<
+		" samples in " << nf;
+	std::string str = title.str();
+	DefaultTimeLog log(str);
+	for (size_t t = 0; t < count; t++) {
+		correlate_peaks(f.data(), nf, templates[t].data(), ng, 1, peaks, true);
+		found += !peaks.empty() && round(peaks[0].lag) == offsets[t];
+	}
+	log.stop();
+	std::cerr << found << " of " << count << " found" << std::endl;
+
+	found = 0;
+	std::stringstream bank_title;
+	bank_title << "bank " << count << " templates " << ng << " samples in " << nf;
+	str = bank_title.str();
+	DefaultTimeLog bank_log(str);
+	CorrelatorBank<TestType> bank(templates, 1, true);
+	//like a stream arriving in chunks
+	for (size_t i = 0; i < nf; i += 4096) {
+		bank.push(f.data() + i, std::min<size_t>(4096, nf - i));
+	}
+	bank.flush();
+	for (size_t t = 0; t < count; t++) {
+		bank.peaks(t, peaks);
+		found += !peaks.empty() && round(peaks[0].lag) == offsets[t];
+	}
+	bank_log.stop();
+	std::cerr << found << " of " << count << " found, fft size " <<
+		bank.fft_size() << std::endl;
+	return 0;
+}
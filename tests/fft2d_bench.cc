@@ -0,0 +1,92 @@
+#include <cstring>
+#include <cstdlib>
+#include <complex>
+#include <sstream>
+#include <iostream>
+#include <vector>
+
+#include "../timelog.hh"
+#include "../fft.hh"
+
+#define MIN_LOG2 8
+#define MAX_LOG2 12
+//every size runs about this many points in total
+#define POINTS_PER_SIZE (1 << 24)
+
+typedef double TestType;
+
+//columns one element per row through execute_strided
+static void strided_2d(std::complex<TestType> *data, size_t width,
+	size_t height, FftPlan<TestType> &rows, FftPlan<TestType> &columns)
+{
+	for (size_t i = 0; i < width; i++) {
+		columns.execute_strided(data + i, width);
+	}
+	for (size_t i = 0; i < height; i++) {
+		rows.execute(data + width * i);
+	}
+}
+
+static void runTest(size_t side, bool blocked, int threads) {
+	size_t size = side * side;
+	std::vector<std::complex<TestType> > data(size);
+	for (size_t i = 0; i < size; i++) {
+		data[i] = rand() % 100;
+	}
+
+	Fft2dPlan<TestType> forward(side, side, false, threads);
+	Fft2dPlan<TestType> inverse(side, side, true, threads);
+	FftPlan<TestType> rows_forward(side, false), rows_inverse(side, true);
+	size_t count = POINTS_PER_SIZE / size;
+	if (!count) {
+		count = 1;
+	}
+
+	std::ostringstream title;
+	title << (blocked ? "blocked" : "strided") << " "
+		<< side << "x" << side << " x " << 2 * count;
+	if (blocked) {
+		title << ", " << forward.threads() << " threads";
+	}
+	std::string str = title.str();
+	DefaultTimeLog log(str);
+	for (size_t i = 0; i < count; i++) {
+		if (blocked) {
+			forward.execute(data.data());
+			inverse.execute(data.data());
+		} else {
+			strided_2d(data.data(), side, side, rows_forward, rows_forward);
+			strided_2d(data.data(), side, side, rows_inverse, rows_inverse);
+		}
+	}
+	log.stop();
+}
+
+int main(int argc, char **argv) {
+	size_t min_log2 = MIN_LOG2;
+	size_t max_log2 = MAX_LOG2;
+	int threads = 0;
+
+	if (argc >= 2 && !strcmp(argv[1], "-h")) {
+		std::cout << "Usage: " << argv[0] << " [min_log2 [max_log2 [threads]]]" << std::endl;
+		return -1;
+	}
+	if (argc >= 2) {
+		min_log2 = atoi(argv[1]);
+	}
+	if (argc >= 3) {
+		max_log2 = atoi(argv[2]);
+	}
+	if (argc >= 4) {
+		threads = atoi(argv[3]);
+	}
+
+	for (size_t log2 = min_log2; log2 <= max_log2; log2++) {
+		size_t side = (size_t)1 << log2;
+		runTest(side, false, 1);
+		runTest(side, true, 1);
+		runTest(side, true, threads);
+	}
+
+	return 0;
+}
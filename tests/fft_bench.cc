@@ -0,0 +1,137 @@
+#include <cstring>
+#include <cstdlib>
+#include <complex>
+#include <sstream>
+#include <iostream>
+#include <vector>
+
+#include "../timelog.hh"
+#include "../fft.hh"
+
+#define MIN_LOG2 10
+#define MAX_LOG2 24
+//every size runs about this many points in total
+#define POINTS_PER_SIZE (1 << 24)
+//points in one batch of the batched test
+#define BATCH_POINTS (1 << 16)
+//prime above 2^20, Bluestein pads it to 2^22 where FFT_AUTO goes four-step
+#define BLUESTEIN_PRIME 1048583
+
+typedef double TestType;
+
+static void runTest(size_t size, FftAlgorithm algorithm, const char *name) {
+	std::vector<std::complex<TestType> > data(size);
+	for (size_t i = 0; i < size; i++) {
+		data[i] = rand() % 100;
+	}
+
+	FftPlan<TestType> forward(size, false, algorithm);
+	FftPlan<TestType> inverse(size, true, algorithm);
+	size_t count = POINTS_PER_SIZE / size;
+	if (!count) {
+		count = 1;
+	}
+
+	std::ostringstream title;
+	title << name << " size " << size << " x " << 2 * count;
+	std::string str = title.str();
+	DefaultTimeLog log(str);
+	for (size_t i = 0; i < count; i++) {
+		forward.execute(data.data());
+		inverse.execute(data.data());
+	}
+	log.stop();
+}
+
+static void runBatchTest(size_t size) {
+	size_t batch = BATCH_POINTS / size;
+	if (!batch) {
+		batch = 1;
+	}
+	std::vector<std::complex<TestType> > data(size * batch);
+	for (size_t i = 0; i < data.size(); i++) {
+		data[i] = rand() % 100;
+	}
+
+	FftBatchPlan<TestType> forward(size, false);
+	FftBatchPlan<TestType> inverse(size, true);
+	size_t count = POINTS_PER_SIZE / data.size();
+	if (!count) {
+		count = 1;
+	}
+
+	std::ostringstream title;
+	title << "batched size " << size << " x " << 2 * count * batch;
+	std::string str = title.str();
+	DefaultTimeLog log(str);
+	for (size_t i = 0; i < count; i++) {
+		forward.execute(data.data(), batch, 1, size);
+		inverse.execute(data.data(), batch, 1, size);
+	}
+	log.stop();
+}
+
+//checks X[0] and the round trip, the inner plans need their workspace
+static bool runBluesteinTest(size_t size) {
+	std::vector<std::complex<TestType> > data(size), orig;
+	TestType sum = 0;
+	for (size_t i = 0; i < size; i++) {
+		data[i] = rand() % 100;
+		sum += data[i].real();
+	}
+	orig = data;
+
+	FftPlan<TestType> forward(size, false);
+	FftPlan<TestType> inverse(size, true);
+
+	std::ostringstream title;
+	title << "bluestein size " << size << " x 2";
+	std::string str = title.str();
+	DefaultTimeLog log(str);
+	forward.execute(data.data());
+	TestType dc_err = std::abs(data[0] - sum) / sum;
+	inverse.execute(data.data());
+	log.stop();
+
+	TestType err = 0;
+	for (size_t i = 0; i < size; i++) {
+		err = std::max(err, std::abs(data[i] - orig[i]));
+	}
+	if (dc_err > 1e-9 || err > 1e-6) {
+		std::cout << "bluestein size " << size << " wrong: X[0] error "
+			<< dc_err << ", round trip error " << err << std::endl;
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+	size_t min_log2 = MIN_LOG2;
+	size_t max_log2 = MAX_LOG2;
+
+	if (argc >= 2 && !strcmp(argv[1], "-h")) {
+		std::cout << "Usage: " << argv[0] << " [min_log2 [max_log2]]" << std::endl;
+		return -1;
+	}
+	if (argc >= 2) {
+		min_log2 = atoi(argv[1]);
+	}
+	if (argc >= 3) {
+		max_log2 = atoi(argv[2]);
+	}
+
+	for (size_t log2 = min_log2; log2 <= max_log2; log2++) {
+		size_t size = (size_t)1 << log2;
+		runTest(size, FFT_RADIX2, "radix-2 in place");
+		runTest(size, FFT_RADIX4, "radix-4 in place");
+		runTest(size, FFT_STOCKHAM, "stockham");
+		runTest(size, FFT_FOUR_STEP, "four-step");
+		runBatchTest(size);
+	}
+
+	if (!runBluesteinTest(BLUESTEIN_PRIME)) {
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,76 @@
+#include <cstring>
+#include <cstdlib>
+#include <complex>
+#include <sstream>
+#include <iostream>
+#include <vector>
+
+#include "../timelog.hh"
+#include "../fft_tuner.hh"
+
+#define MIN_LOG2 6
+#define MAX_LOG2 20
+//every size runs about this many points in total
+#define POINTS_PER_SIZE (1 << 24)
+
+typedef double TestType;
+
+template <class Plan>
+static void runTest(Plan &forward, Plan &inverse, size_t size,
+	const std::string &name)
+{
+	std::vector<std::complex<TestType> > data(size);
+	for (size_t i = 0; i < size; i++) {
+		data[i] = rand() % 100;
+	}
+
+	size_t count = POINTS_PER_SIZE / size;
+	if (!count) {
+		count = 1;
+	}
+
+	std::ostringstream title;
+	title << name << " size " << size << " x " << 2 * count;
+	std::string str = title.str();
+	DefaultTimeLog log(str);
+	for (size_t i = 0; i < count; i++) {
+		forward.execute(data.data());
+		inverse.execute(data.data());
+	}
+	log.stop();
+}
+
+int main(int argc, char **argv) {
+	size_t min_log2 = MIN_LOG2;
+	size_t max_log2 = MAX_LOG2;
+
+	if (argc >= 2 && !strcmp(argv[1], "-h")) {
+		std::cout << "Usage: " << argv[0]
+			<< " [wisdom_file [min_log2 [max_log2]]]" << std::endl;
+		return -1;
+	}
+	if (argc >= 2) {
+		fft_tuner().set_wisdom_file(argv[1]);
+	}
+	if (argc >= 3) {
+		min_log2 = atoi(argv[2]);
+	}
+	if (argc >= 4) {
+		max_log2 = atoi(argv[3]);
+	}
+
+	for (size_t log2 = min_log2; log2 <= max_log2; log2++) {
+		size_t size = (size_t)1 << log2;
+
+		FftPlan<TestType> forward(size, false), inverse(size, true);
+		runTest(forward, inverse, size, "default plan");
+
+		TunedFftPlan<TestType> tuned_forward(size, false);
+		TunedFftPlan<TestType> tuned_inverse(size, true);
+		std::string name = std::string("tuned ") +
+			tuned_forward.variant_name() + "/" + tuned_inverse.variant_name();
+		runTest(tuned_forward, tuned_inverse, size, name);
+	}
+
+	return 0;
+}
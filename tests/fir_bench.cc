@@ -0,0 +1,67 @@
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "../timelog.hh"
+#include "../convolution.hh"
+#include "../fir.hh"
+
+#define NUM_SAMPLES (1 << 20)
+
+/*
+ * FirFilter with the widest SIMD kernel against the scalar kernel and
+ * convolve1D for 8 to 512 taps.
+ * usage: fir_bench [max taps]
+ */
+template <class T>
+static void runFirTest(const char *type, size_t taps, FftSimdLevel level) {
+	std::vector<T> coeffs(taps), in(NUM_SAMPLES), out(NUM_SAMPLES);
+	for (size_t i = 0; i < taps; i++) {
+		coeffs[i] = static_cast<T>(rand() % 2001 - 1000) / 64;
+	}
+	for (size_t i = 0; i < NUM_SAMPLES; i++) {
+		in[i] = static_cast<T>(rand() % 2001 - 1000);
+	}
+
+	FirFilter<T> filter(coeffs.data(), taps, level);
+	std::stringstream title;
+	title << "fir " << type << " " << taps << " taps, simd level " <<
+		filter.level();
+	std::string str = title.str();
+	DefaultTimeLog log(str);
+	filter.process(in.data(), out.data(), NUM_SAMPLES);
+	log.stop();
+}
+
+template <class T>
+static void runConvolveTest(const char *type, size_t taps) {
+	std::vector<T> coeffs(taps), in(NUM_SAMPLES), out(NUM_SAMPLES);
+	for (size_t i = 0; i < taps; i++) {
+		coeffs[i] = static_cast<T>(rand() % 2001 - 1000) / 64;
+	}
+	for (size_t i = 0; i < NUM_SAMPLES; i++) {
+		in[i] = static_cast<T>(rand() % 2001 - 1000);
+	}
+
+	std::stringstream title;
+	title << "convolve1D " << type << " " << taps << " taps";
+	std::string str = title.str();
+	DefaultTimeLog log(str);
+	convolve1D(in, coeffs, out);
+	log.stop();
+}
+
+int main(int argc, char **argv) {
+	size_t max_taps = argc > 1 ? atoi(argv[1]) : 512;
+
+	for (size_t taps = 8; taps <= max_taps; taps *= 4) {
+		runConvolveTest<float>("float", taps);
+		runFirTest<float>("float", taps, FFT_SIMD_NONE);
+		runFirTest<float>("float", taps, fft_simd_level());
+		runFirTest<double>("double", taps, fft_simd_level());
+		runFirTest<int16_t>("int16", taps, FFT_SIMD_NONE);
+		runFirTest<int16_t>("int16", taps, fft_simd_level());
+	}
+	return 0;
+}
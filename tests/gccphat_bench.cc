@@ -0,0 +1,84 @@
+#include <cstdlib>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "../timelog.hh"
+#include "../correlation.hh"
+
+typedef float TestType;
+
+/*
+ * GCC-PHAT delays between all channels of a simulated array recording,
+ * with shared per-channel spectra against one two-channel estimator per
+ * pair, which transforms every channel once per pair.
+ * usage: gccphat_bench [channels] [seconds] [block]
+ */
+int main(int argc, char **argv) {
+	size_t channels = argc > 1 ? atoi(argv[1]) : 16;
+	size_t seconds = argc > 2 ? atoi(argv[2]) : 10;
+	size_t block = argc > 3 ? atoi(argv[3]) : 8192;
+	size_t frames = 48000 * seconds;
+	const size_t max_shift = 64;
+
+	//one coloured source reaching each mic with its own delay and noise
+	std::vector<TestType> source(frames + max_shift);
+	double lp = 0;
+	for (size_t i = 0; i < source.size(); i++) {
+		lp = 0.9 * lp + (rand() % 2000 - 1000) / 1000.0;
+		source[i] = lp;
+	}
+	std::vector<size_t> shift(channels);
+	std::vector<TestType> data(frames * channels);
+	for (size_t c = 0; c < channels; c++) {
+		shift[c] = rand() % max_shift;
+		for (size_t i = 0; i < frames; i++) {
+			data[i * channels + c] = source[max_shift + i - shift[c]] +
+				(rand() % 2000 - 1000) / 5000.0;
+		}
+	}
+
+	std::vector<ChannelDelay> delays;
+	size_t correct = 0, total = 0;
+	std::stringstream title;
+	title << "shared spectra " << channels << " channels " << seconds <<
+		" s block " << block;
+	std::string str = title.str();
+	DefaultTimeLog log(str);
+	GccPhat<TestType> phat(channels, block, 2 * max_shift);
+	for (size_t i = 0; i < frames; i += block) {
+		phat.process_block(data.data() + i * channels,
+			std::min(block, frames - i), delays);
+		for (size_t p = 0; p < delays.size(); p++) {
+			long expected = (long)shift[delays[p].first] -
+				(long)shift[delays[p].second];
+			correct += lround(delays[p].delay) == expected;
+			total++;
+		}
+	}
+	log.stop();
+	std::cerr << correct << " of " << total << " delays right" << std::endl;
+
+	std::stringstream pair_title;
+	pair_title << "per pair " << channels << " channels " << seconds <<
+		" s block " << block;
+	str = pair_title.str();
+	DefaultTimeLog pair_log(str);
+	GccPhat<TestType> two(2, block, 2 * max_shift);
+	std::vector<TestType> stereo(2 * block);
+	for (size_t i = 0; i < frames; i += block) {
+		size_t n = std::min(block, frames - i);
+		for (size_t a = 0; a < channels; a++) {
+			for (size_t b = a + 1; b < channels; b++) {
+				for (size_t j = 0; j < n; j++) {
+					stereo[2 * j] = data[(i + j) * channels + a];
+					stereo[2 * j + 1] = data[(i + j) * channels + b];
+				}
+				two.process_block(stereo.data(), n, delays);
+			}
+		}
+	}
+	pair_log.stop();
+	return 0;
+}
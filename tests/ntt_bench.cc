@@ -0,0 +1,57 @@
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "../timelog.hh"
+#include "../ntt.hh"
+
+/*
+ * Exact products of random integer polynomials through the NTT, from
+ * 2^10 to 2^max_log2 terms, coefficients below 2^bits in magnitude.
+ * Three coefficients of every product are checked against the direct
+ * sum. From max_log2 23 on the products are longer than the largest
+ * transform of the first prime and go through the blocked path.
+ * usage: ntt_bench [max_log2] [bits]
+ */
+static bool runTest(size_t terms, int bits) {
+	std::vector<int64_t> a(terms), b(terms), out;
+	for (size_t i = 0; i < terms; i++) {
+		a[i] = (static_cast<int64_t>(rand()) << 16 ^ rand()) %
+			(int64_t(1) << bits) - (int64_t(1) << (bits - 1));
+		b[i] = (static_cast<int64_t>(rand()) << 16 ^ rand()) %
+			(int64_t(1) << bits) - (int64_t(1) << (bits - 1));
+	}
+
+	std::stringstream title;
+	title << "ntt product of " << terms << " terms, " << bits << " bits";
+	std::string str = title.str();
+	DefaultTimeLog log(str);
+	poly_multiply(a, b, out);
+	log.stop();
+
+	//the first, middle and last coefficient
+	for (size_t k = 0; k < 2 * terms - 1; k += terms - 1) {
+		int64_t sum = 0;
+		for (size_t i = k < terms ? 0 : k - terms + 1; i <= k && i < terms; i++) {
+			sum += a[i] * b[k - i];
+		}
+		if (sum != out[k]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+	size_t max_log2 = argc > 1 ? atoi(argv[1]) : 20;
+	int bits = argc > 2 ? atoi(argv[2]) : 20;
+
+	for (size_t lg = 10; lg <= max_log2; lg += 2) {
+		if (!runTest(size_t(1) << lg, bits)) {
+			std::cerr << "mismatch" << std::endl;
+			return 1;
+		}
+	}
+	return 0;
+}
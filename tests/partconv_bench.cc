@@ -0,0 +1,66 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "../timelog.hh"
+#include "../convolution.hh"
+
+typedef float TestType;
+
+/*
+ * Filters a few seconds of noise with a reverb length filter through
+ * uniform and non-uniform partitioned convolution and prints the total
+ * time and the slowest block, which is what a real-time callback sees.
+ * usage: partconv_bench [taps] [block] [max partition]
+ */
+static void runTest(const std::vector<TestType> &filter,
+	const std::vector<TestType> &signal, size_t block, size_t max_partition)
+{
+	typedef std::chrono::steady_clock Clock;
+	PartitionedConvolver<TestType> conv(filter.data(), filter.size(),
+		block, max_partition);
+	std::vector<TestType> out(conv.block_size());
+
+	std::stringstream title;
+	title << "partitioned " << filter.size() << " taps, block " <<
+		conv.block_size() << ", partitions";
+	std::vector<std::pair<size_t, size_t> > layout = conv.layout();
+	for (size_t i = 0; i < layout.size(); i++) {
+		title << " " << layout[i].second << "x" << layout[i].first;
+	}
+	std::string str = title.str();
+
+	double slowest = 0;
+	DefaultTimeLog log(str);
+	for (size_t pos = 0; pos + conv.block_size() <= signal.size();
+		pos += conv.block_size())
+	{
+		Clock::time_point start = Clock::now();
+		conv.process_block(signal.data() + pos, out.data());
+		double us = std::chrono::duration<double, std::micro>(
+			Clock::now() - start).count();
+		slowest = std::max(slowest, us);
+	}
+	log.stop();
+	std::cerr << "slowest block " << slowest << " usec" << std::endl;
+}
+
+int main(int argc, char **argv) {
+	size_t taps = argc > 1 ? atoi(argv[1]) : 96000;
+	size_t block = argc > 2 ? atoi(argv[2]) : 64;
+	size_t max_partition = argc > 3 ? atoi(argv[3]) : PARTCONV_MAX_PARTITION;
+
+	std::vector<TestType> filter(taps), signal(48000 * 5);
+	for (size_t i = 0; i < taps; i++) {
+		filter[i] = (rand() % 2001 - 1000) * 1e-3f / (1 + i / 4800.0f);
+	}
+	for (size_t i = 0; i < signal.size(); i++) {
+		signal[i] = (rand() % 2001 - 1000) * 1e-3f;
+	}
+
+	runTest(filter, signal, block, block);
+	runTest(filter, signal, block, max_partition);
+	return 0;
+}
@@ -0,0 +1,86 @@
+#include <cstdlib>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "../timelog.hh"
+#include "../correlation.hh"
+
+typedef float TestType;
+
+/*
+ * Autocorrelation of a sliding window over a noisy tone, recomputed from
+ * scratch every hop (direct and FFT) against SlidingAutocorrelator, and
+ * the pitch it finds.
+ * usage: sliding_bench [window] [max lag] [hop]
+ */
+int main(int argc, char **argv) {
+	size_t window = argc > 1 ? atoi(argv[1]) : 4096;
+	size_t max_lag = argc > 2 ? atoi(argv[2]) : 1024;
+	size_t hop = argc > 3 ? atoi(argv[3]) : 256;
+	const double rate = 48000;
+	size_t n = 48000 * 10;
+
+	std::vector<TestType> x(n);
+	for (size_t i = 0; i < n; i++) {
+		x[i] = sin(2 * M_PI * 196 * i / rate) +
+			0.5 * sin(2 * M_PI * 392 * i / rate) +
+			(rand() % 200 - 100) / 1000.0;
+	}
+
+	std::vector<TestType> r(max_lag + 1), full;
+	double check = 0;
+	std::stringstream title;
+	title << "recompute direct window " << window << " lags " << max_lag <<
+		" hop " << hop;
+	std::string str = title.str();
+	DefaultTimeLog log(str);
+	for (size_t end = window; end <= n; end += hop) {
+		const TestType *w = x.data() + end - window;
+		for (size_t lag = 0; lag <= max_lag; lag++) {
+			TestType acc = 0;
+			for (size_t i = lag; i < window; i++) {
+				acc += w[i] * w[i - lag];
+			}
+			r[lag] = acc;
+		}
+		check += r[max_lag / 2];
+	}
+	log.stop();
+
+	std::stringstream fft_title;
+	fft_title << "recompute fft window " << window << " lags " << max_lag <<
+		" hop " << hop;
+	str = fft_title.str();
+	DefaultTimeLog fft_log(str);
+	for (size_t end = window; end <= n; end += hop) {
+		const TestType *w = x.data() + end - window;
+		full.resize(2 * window - 1);
+		correlate(w, window, w, window, full.data(), CONV_FFT);
+		check += full[window - 1 + max_lag / 2];
+	}
+	fft_log.stop();
+
+	SlidingAutocorrelator<TestType> ac(window, max_lag, hop);
+	PitchEstimate est = {0, 0, 0};
+	size_t voiced = 0;
+	std::stringstream sliding_title;
+	sliding_title << "sliding window " << ac.window() << " lags " << max_lag <<
+		" hop " << hop << " with pitch";
+	str = sliding_title.str();
+	DefaultTimeLog sliding_log(str);
+	for (size_t i = 0; i + hop <= n; i += hop) {
+		ac.push(x.data() + i, hop);
+		voiced += ac.pitch(rate, est);
+		ac.correlation(r.data());
+		check += r[max_lag / 2];
+	}
+	sliding_log.stop();
+
+	std::cerr << "pitch " << est.frequency << " Hz, periodicity " <<
+		est.periodicity << ", " << voiced << " voiced hops" << std::endl;
+	//keeps the loops from being optimized out
+	std::cerr << "checksum " << check << std::endl;
+	return 0;
+}
@@ -0,0 +1,60 @@
+#include <cstdlib>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "../timelog.hh"
+#include "../windowfunction.hh"
+
+typedef float TestType;
+
+/*
+ * Windows STFT frames the way a worker that builds its window per
+ * request does, computing the cosines every time, against looking the
+ * table up in the registry and applying it with SIMD.
+ * usage: window_bench [length] [frames]
+ */
+int main(int argc, char **argv) {
+	size_t length = argc > 1 ? atoi(argv[1]) : 4096;
+	size_t frames = argc > 2 ? atoi(argv[2]) : 20000;
+
+	std::vector<TestType> frame(length), out(length);
+	for (size_t i = 0; i < length; i++) {
+		frame[i] = (rand() % 2000 - 1000) / 1000.0;
+	}
+	double check = 0;
+
+	std::stringstream title;
+	title << "computed per frame " << frames << " x " << length;
+	std::string str = title.str();
+	DefaultTimeLog log(str);
+	for (size_t f = 0; f < frames; f++) {
+		double *coeffs = new double[length];
+		double phi = 2 * M_PI / (length - 1);
+		for (size_t i = 0; i < length; i++) {
+			coeffs[i] = 0.5 - 0.5 * cos(i * phi);
+		}
+		for (size_t i = 0; i < length; i++) {
+			out[i] = frame[i] * coeffs[i];
+		}
+		delete[] coeffs;
+		check += out[length / 3];
+	}
+	log.stop();
+
+	std::stringstream registry_title;
+	registry_title << "registry " << frames << " x " << length;
+	str = registry_title.str();
+	DefaultTimeLog registry_log(str);
+	for (size_t f = 0; f < frames; f++) {
+		window_table<TestType>(WINDOW_HANN, length)->apply(frame.data(),
+			out.data());
+		check += out[length / 3];
+	}
+	registry_log.stop();
+
+	//keeps the loops from being optimized out
+	std::cerr << "checksum " << check << std::endl;
+	return 0;
+}
@@ -0,0 +1,45 @@
+#include "SoundOpenAl.hpp"
+#include "../correlation.hh"
+
+#include <cstdio>
+#include <vector>
+
+#define FREQ_BASE 8000
+//50 ms hops over a 150 ms window, a whole number of hops, pitch from 50 Hz up
+#define HOP (FREQ_BASE / 20)
+#define WINDOW (3 * HOP)
+#define MAX_LAG (FREQ_BASE / 50)
+
+/*
+ * Prints the pitch of what the capture device hears, e.g. tonegen
+ * playing on the same machine, one line per capture with a new hop.
+ */
+int main(int argc, char **argv) {
+	SoundOpenAlRecorder recorder(FREQ_BASE);
+	SlidingAutocorrelator<float> tracker(WINDOW, MAX_LAG, HOP);
+
+	//receiveData() hands over everything captured so far
+	std::vector<unsigned char> raw(FREQ_BASE);
+	std::vector<float> samples(FREQ_BASE);
+
+	while (1) {
+		unsigned count = recorder.receiveData(raw.data(), HOP);
+		for (unsigned i = 0; i < count; i++) {
+			samples[i] = (raw[i] - 128) / 128.0f;
+		}
+		if (!tracker.push(samples.data(), count)) {
+			continue;
+		}
+
+		PitchEstimate est;
+		if (tracker.pitch(FREQ_BASE, est)) {
+			printf("pitch %.1f Hz periodicity %.2f\n",
+				est.frequency, est.periodicity);
+		}
+		else {
+			printf("unvoiced\n");
+		}
+	}
+
+	return 0;
+}
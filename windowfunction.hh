@@ -3,6 +3,369 @@
 
 #define _USE_MATH_DEFINES
 #include <math.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "fft_simd.hh"
+
+/*
+ * Window functions come from a registry of immutable coefficient tables
+ * keyed by (type, length, parameter, periodic) per sample type: the
+ * first request computes the table, every later one shares it, so
+ * building a window per STFT frame or request is a map lookup. Tables
+ * are aligned to WINDOW_ALIGN and applied with the widest vectors the
+ * CPU has (picked once per table like FirFilter), with no virtual call
+ * and no allocation per frame.
+ *
+ * Symmetric windows (the default) end on the same value they start
+ * with, for filter design; periodic ones are the first length samples
+ * of a window one longer, what an STFT with overlap wants.
+ */
+
+//alignment of the coefficient tables in bytes
+#define WINDOW_ALIGN 64
+
+enum WindowType {
+	WINDOW_RECTANGULAR,
+	WINDOW_HANN,
+	WINDOW_HAMMING,
+	//4-term, -92 dB sidelobes
+	WINDOW_BLACKMAN_HARRIS,
+	//parameter beta, 8.6 by default
+	WINDOW_KAISER,
+	//for amplitude measurements, 5 terms
+	WINDOW_FLAT_TOP,
+	//parameter alpha, the tapered fraction, 0.5 by default
+	WINDOW_TUKEY
+};
+
+static inline double window_default_parameter(WindowType type) {
+	switch (type) {
+	case WINDOW_KAISER:
+		return 8.6;
+	case WINDOW_TUKEY:
+		return 0.5;
+	default:
+		return 0;
+	}
+}
+
+//modified Bessel function of the first kind, order 0, by its series
+static inline double window_bessel_i0(double x) {
+	double sum = 1, term = 1, q = x * x / 4;
+	for (int k = 1; k < 200 && term > sum * 1e-17; k++) {
+		term *= q / (static_cast<double>(k) * k);
+		sum += term;
+	}
+	return sum;
+}
+
+//sum of a[k] * (-1)^k * cos(2 * pi * k * x)
+static inline double window_cosine_sum(const double *a, size_t terms,
+	double x)
+{
+	double sum = 0, sign = 1;
+	for (size_t k = 0; k < terms; k++) {
+		sum += sign * a[k] * cos(2 * M_PI * k * x);
+		sign = -sign;
+	}
+	return sum;
+}
+
+//the coefficient at x = i / (length - 1), or i / length if periodic
+static inline double window_value(WindowType type, double param, double x) {
+	static const double hann[] = {0.5, 0.5};
+	static const double hamming[] = {0.54, 0.46};
+	static const double blackman_harris[] = {0.35875, 0.48829, 0.14128,
+		0.01168};
+	static const double flat_top[] = {0.21557895, 0.41663158, 0.277263158,
+		0.083578947, 0.006947368};
+
+	switch (type) {
+	case WINDOW_HANN:
+		return window_cosine_sum(hann, 2, x);
+	case WINDOW_HAMMING:
+		return window_cosine_sum(hamming, 2, x);
+	case WINDOW_BLACKMAN_HARRIS:
+		return window_cosine_sum(blackman_harris, 4, x);
+	case WINDOW_FLAT_TOP:
+		return window_cosine_sum(flat_top, 5, x);
+	case WINDOW_KAISER: {
+		double r = 2 * x - 1;
+		return window_bessel_i0(param * sqrt(std::max(0.0, 1 - r * r))) /
+			window_bessel_i0(param);
+	}
+	case WINDOW_TUKEY:
+		if (param <= 0) {
+			return 1;
+		}
+		if (x < param / 2) {
+			return 0.5 - 0.5 * cos(2 * M_PI * x / param);
+		}
+		if (x > 1 - param / 2) {
+			return 0.5 - 0.5 * cos(2 * M_PI * (1 - x) / param);
+		}
+		return 1;
+	default:
+		return 1;
+	}
+}
+
+//out[i] = in[i] * w[i], in and out may be the same
+template <class V, class T>
+static FFT_SIMD_INLINE void window_mul(const T *w, const T *in, T *out,
+	size_t count)
+{
+	const size_t width = sizeof(V) / sizeof(T);
+	size_t i = 0;
+	for (; i + width <= count; i += width) {
+		V a, b;
+		simd_load(a, in + i);
+		simd_load(b, w + i);
+		simd_store(out + i, a * b);
+	}
+	for (; i < count; i++) {
+		out[i] = in[i] * w[i];
+	}
+}
+
+template <class T>
+static void window_apply_scalar(const T *w, const T *in, T *out,
+	size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		out[i] = in[i] * w[i];
+	}
+}
+
+#ifdef FFT_SIMD_X86
+template <class T>
+__attribute__((target("sse2")))
+static void window_apply_sse2(const T *w, const T *in, T *out, size_t count)
+{
+	window_mul<typename SimdVector<T, 16>::type>(w, in, out, count);
+}
+
+template <class T>
+__attribute__((target("avx2")))
+static void window_apply_avx2(const T *w, const T *in, T *out, size_t count)
+{
+	window_mul<typename SimdVector<T, 32>::type>(w, in, out, count);
+}
+
+template <class T>
+__attribute__((target("avx512f")))
+static void window_apply_avx512(const T *w, const T *in, T *out,
+	size_t count)
+{
+	window_mul<typename SimdVector<T, 64>::type>(w, in, out, count);
+}
+#elif defined(__GNUC__)
+template <class T>
+static void window_apply_vector(const T *w, const T *in, T *out,
+	size_t count)
+{
+	window_mul<typename SimdVector<T, 16>::type>(w, in, out, count);
+}
+#endif
+
+//vector kernels for float and double, anything else multiplies in a loop
+template <class T>
+struct WindowKernel {
+	typedef void (*Func)(const T *w, const T *in, T *out, size_t count);
+	static Func select(FftSimdLevel) {
+		return window_apply_scalar<T>;
+	}
+};
+
+template <class T>
+struct WindowVectorKernel {
+	typedef void (*Func)(const T *w, const T *in, T *out, size_t count);
+	static Func select(FftSimdLevel level) {
+#ifdef FFT_SIMD_X86
+		if (level >= FFT_SIMD_AVX512) {
+			return window_apply_avx512<T>;
+		}
+		if (level >= FFT_SIMD_AVX2) {
+			return window_apply_avx2<T>;
+		}
+		if (level >= FFT_SIMD_SSE2) {
+			return window_apply_sse2<T>;
+		}
+#elif defined(__GNUC__)
+		if (level != FFT_SIMD_NONE) {
+			return window_apply_vector<T>;
+		}
+#endif
+		return window_apply_scalar<T>;
+	}
+};
+
+template <>
+struct WindowKernel<float> : public WindowVectorKernel<float> {
+};
+
+template <>
+struct WindowKernel<double> : public WindowVectorKernel<double> {
+};
+
+/*
+ * Immutable, aligned window coefficients. Get them from window_table(),
+ * which shares one table per shape between all callers and threads.
+ */
+template <class T>
+class WindowTable {
+protected:
+	typedef typename WindowKernel<T>::Func KernelFunc;
+
+	WindowType mType;
+	size_t mLength;
+	double mParam;
+	bool mPeriodic;
+	KernelFunc mKernel;
+	//mLength coefficients at mCoeffs, aligned to WINDOW_ALIGN
+	std::vector<T> mStorage;
+	T *mCoeffs;
+
+public:
+	WindowTable(WindowType type, size_t length, double param,
+		bool periodic, FftSimdLevel level = fft_simd_level())
+		: mType(type), mLength(length), mParam(param), mPeriodic(periodic),
+		mKernel(WindowKernel<T>::select(level)),
+		mStorage(length + WINDOW_ALIGN / sizeof(T) + 1)
+	{
+		size_t misalign = reinterpret_cast<uintptr_t>(
+			mStorage.data()) % WINDOW_ALIGN;
+		mCoeffs = mStorage.data() +
+			(misalign ? (WINDOW_ALIGN - misalign) / sizeof(T) : 0);
+
+		double span = periodic ? length : length - 1;
+		for (size_t i = 0; i < length; i++) {
+			mCoeffs[i] = static_cast<T>(span > 0 ?
+				window_value(type, param, i / span) : 1);
+		}
+	}
+
+	inline WindowType type() const {
+		return mType;
+	}
+
+	inline size_t length() const {
+		return mLength;
+	}
+
+	inline double parameter() const {
+		return mParam;
+	}
+
+	inline bool periodic() const {
+		return mPeriodic;
+	}
+
+	inline const T *data() const {
+		return mCoeffs;
+	}
+
+	inline T operator[](size_t i) const {
+		return mCoeffs[i];
+	}
+
+	//length() samples in place
+	inline void apply(T *data) const {
+		mKernel(mCoeffs, data, data, mLength);
+	}
+
+	//out = in * window, length() samples, in and out may be the same
+	inline void apply(const T *in, T *out) const {
+		mKernel(mCoeffs, in, out, mLength);
+	}
+};
+
+template <class T>
+class WindowRegistry {
+public:
+	typedef std::shared_ptr<const WindowTable<T> > Table;
+
+protected:
+	struct Key {
+		WindowType type;
+		size_t length;
+		double param;
+		bool periodic;
+
+		bool operator<(const Key &other) const {
+			if (type != other.type) {
+				return type < other.type;
+			}
+			if (length != other.length) {
+				return length < other.length;
+			}
+			if (param != other.param) {
+				return param < other.param;
+			}
+			return periodic < other.periodic;
+		}
+	};
+
+	std::mutex mLock;
+	std::map<Key, Table> mTables;
+
+public:
+	Table get(WindowType type, size_t length, double param, bool periodic) {
+		Key key;
+		key.type = type;
+		key.length = length;
+		//the parameter only tells Kaiser and Tukey windows apart
+		key.param = (type == WINDOW_KAISER || type == WINDOW_TUKEY) ?
+			param : 0;
+		key.periodic = periodic;
+
+		std::lock_guard<std::mutex> guard(mLock);
+		typename std::map<Key, Table>::iterator it = mTables.find(key);
+		if (it != mTables.end()) {
+			return it->second;
+		}
+		Table table(new WindowTable<T>(type, length, key.param, periodic));
+		mTables[key] = table;
+		return table;
+	}
+
+	//tables still held by callers stay valid
+	void clear() {
+		std::lock_guard<std::mutex> guard(mLock);
+		mTables.clear();
+	}
+
+	size_t size() {
+		std::lock_guard<std::mutex> guard(mLock);
+		return mTables.size();
+	}
+};
+
+template <class T>
+static inline WindowRegistry<T> &window_registry() {
+	static WindowRegistry<T> registry;
+	return registry;
+}
+
+/*
+ * The shared table for a window shape, param < 0 takes the default
+ * Kaiser beta or Tukey alpha.
+ */
+template <class T>
+static inline typename WindowRegistry<T>::Table window_table(WindowType type,
+	size_t length, double param = -1, bool periodic = false)
+{
+	if (param < 0) {
+		param = window_default_parameter(type);
+	}
+	return window_registry<T>().get(type, length, param, periodic);
+}
 
 template <class T>
 class WindowFunction {
@@ -11,28 +374,20 @@ public:
 	virtual void apply(T* data) = 0;
 };
 
+//the symmetric Hann window from the registry
 template<class T>
 class HannWindow : public WindowFunction<T> {
 public:
 	HannWindow(size_t length):
-		length(length), coeffs(new double[length]) {
-		double phi = 2 * M_PI / (length - 1);
-		for (size_t i = 0; i < length; i++) {
-			coeffs[i] = 0.5 - 0.5 * cos(i * phi);
-		}
-	}
-	~HannWindow() {
-		delete[] coeffs;
+		length(length), table(window_table<T>(WINDOW_HANN, length)) {
 	}
-	
+
 	void apply(T* data) {
-		for (size_t i = 0; i < length; i++) {
-			data[i] *= coeffs[i];
-		}
+		table->apply(data);
 	}
 protected:
 	size_t length;
-	double *coeffs;
+	typename WindowRegistry<T>::Table table;
 };
 
 #endif